@@ -49,11 +49,11 @@ public:
         return result;
     }
 
-    void erase(const Key &key)
+    size_t erase(const Key &key)
     {
         uint64_t which_map = key % storage_.size();
         std::lock_guard<std::mutex> g(storage_[which_map].map_mutex);
-        storage_[which_map].map_store.erase(key);
+        return storage_[which_map].map_store.erase(key);
     }
 
 private:
@@ -0,0 +1,242 @@
+#include "document_attributes.h"
+#include "memory_usage.h"
+
+#include <cmath>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+uint32_t DocumentAttributes::Add(int document_id, int rating, DocumentStatus status, uint32_t length)
+{
+    const uint32_t ordinal = static_cast<uint32_t>(ids_.size());
+    ids_.push_back(document_id);
+    ratings_.push_back(rating);
+    statuses_.push_back(status);
+    lengths_.push_back(length);
+    alive_.push_back(1);
+    ++alive_count_;
+    alive_length_sum_ += length;
+    for (auto &[field, column] : numeric_fields_)
+    {
+        column.push_back(NAN);
+    }
+    return ordinal;
+}
+
+void DocumentAttributes::Remove(uint32_t ordinal)
+{
+    if (alive_[ordinal])
+    {
+        alive_[ordinal] = 0;
+        --alive_count_;
+        alive_length_sum_ -= lengths_[ordinal];
+    }
+}
+
+double DocumentAttributes::GetAverageLength() const
+{
+    return alive_count_ == 0 ? 0.0 : alive_length_sum_ * 1.0 / alive_count_;
+}
+
+size_t DocumentAttributes::GetMemoryUsage() const
+{
+    size_t bytes = GetVectorBytes(ids_) + GetVectorBytes(ratings_) + GetVectorBytes(statuses_) +
+                   GetVectorBytes(lengths_) + GetVectorBytes(alive_) + GetTreeBytes(numeric_fields_);
+    for (const auto &[field, column] : numeric_fields_)
+    {
+        bytes += GetStringBytes(field) + GetVectorBytes(column);
+    }
+    return bytes;
+}
+
+namespace
+{
+template <typename T>
+vector<T> Permute(const vector<T> &column, const vector<uint32_t> &order)
+{
+    vector<T> result;
+    result.reserve(order.size());
+    for (const uint32_t ordinal : order)
+    {
+        result.push_back(column[ordinal]);
+    }
+    return result;
+}
+} // namespace
+
+void DocumentAttributes::Reorder(const vector<uint32_t> &order)
+{
+    ids_ = Permute(ids_, order);
+    ratings_ = Permute(ratings_, order);
+    statuses_ = Permute(statuses_, order);
+    lengths_ = Permute(lengths_, order);
+    alive_ = Permute(alive_, order);
+    for (auto &[field, column] : numeric_fields_)
+    {
+        column = Permute(column, order);
+    }
+    alive_count_ = 0;
+    alive_length_sum_ = 0;
+    for (size_t i = 0; i < alive_.size(); ++i)
+    {
+        if (alive_[i])
+        {
+            ++alive_count_;
+            alive_length_sum_ += lengths_[i];
+        }
+    }
+}
+
+void DocumentAttributes::SetNumericField(uint32_t ordinal, string_view field, double value)
+{
+    auto it = numeric_fields_.find(field);
+    if (it == numeric_fields_.end())
+    {
+        it = numeric_fields_.emplace(string(field), vector<double>(ids_.size(), NAN)).first;
+    }
+    it->second[ordinal] = value;
+}
+
+// Every pass below is a flat loop over one column, so the compiler can vectorize it
+vector<uint8_t> DocumentAttributes::Evaluate(const DocumentFilter &filter) const
+{
+    const size_t count = ids_.size();
+    vector<uint8_t> mask(alive_);
+
+    if (filter.status)
+    {
+        const DocumentStatus status = *filter.status;
+        const DocumentStatus *statuses = statuses_.data();
+        uint8_t *out = mask.data();
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] &= static_cast<uint8_t>(statuses[i] == status);
+        }
+    }
+
+    if (filter.min_rating != numeric_limits<int>::min() || filter.max_rating != numeric_limits<int>::max())
+    {
+        const int min_rating = filter.min_rating;
+        const int max_rating = filter.max_rating;
+        const int *ratings = ratings_.data();
+        uint8_t *out = mask.data();
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] &= static_cast<uint8_t>((ratings[i] >= min_rating) & (ratings[i] <= max_rating));
+        }
+    }
+
+    for (const NumericRange &range : filter.numeric_ranges)
+    {
+        auto it = numeric_fields_.find(range.field);
+        if (it == numeric_fields_.end())
+        {
+            // Nobody has this field, so nobody can be inside the range
+            return vector<uint8_t>(count, 0);
+        }
+        const double *values = it->second.data();
+        uint8_t *out = mask.data();
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] &= static_cast<uint8_t>((values[i] >= range.min) & (values[i] <= range.max));
+        }
+    }
+    return mask;
+}
+
+DocumentMask DocumentAttributes::MakeMask(const DocumentFilter &filter, size_t expected_checks) const
+{
+    DocumentMask mask;
+    if (expected_checks * MASK_MATERIALIZE_RATIO >= ids_.size())
+    {
+        mask.is_materialized_ = true;
+        mask.bytes_ = Evaluate(filter);
+        return mask;
+    }
+
+    mask.alive_ = alive_.data();
+    if (filter.status)
+    {
+        mask.statuses_ = statuses_.data();
+        mask.status_ = *filter.status;
+    }
+    if (filter.min_rating != numeric_limits<int>::min() || filter.max_rating != numeric_limits<int>::max())
+    {
+        mask.ratings_ = ratings_.data();
+        mask.min_rating_ = filter.min_rating;
+        mask.max_rating_ = filter.max_rating;
+    }
+    for (const NumericRange &range : filter.numeric_ranges)
+    {
+        auto it = numeric_fields_.find(range.field);
+        if (it == numeric_fields_.end())
+        {
+            mask.rejects_all_ = true;
+            break;
+        }
+        mask.numeric_ranges_.push_back({it->second.data(), range.min, range.max});
+    }
+    return mask;
+}
+
+vector<size_t> DocumentAttributes::CountFacet(const vector<uint32_t> &ordinals, const FacetDefinition &facet) const
+{
+    const size_t bucket_count =
+        facet.field == FacetDefinition::Field::STATUS ? STATUS_COUNT : facet.rating_ranges.size();
+    vector<size_t> counts(bucket_count, 0);
+
+    // A small matched set is counted document by document
+    if (ordinals.size() * DENSE_FACET_RATIO < ids_.size())
+    {
+        for (const uint32_t ordinal : ordinals)
+        {
+            if (facet.field == FacetDefinition::Field::STATUS)
+            {
+                ++counts[static_cast<size_t>(statuses_[ordinal])];
+                continue;
+            }
+            for (size_t bucket = 0; bucket < bucket_count; ++bucket)
+            {
+                const RatingRange &range = facet.rating_ranges[bucket];
+                counts[bucket] += ratings_[ordinal] >= range.min && ratings_[ordinal] <= range.max;
+            }
+        }
+        return counts;
+    }
+
+    // A large one becomes a byte mask, and each bucket is one flat pass over a column
+    const size_t count = ids_.size();
+    vector<uint8_t> matched(count, 0);
+    for (const uint32_t ordinal : ordinals)
+    {
+        matched[ordinal] = 1;
+    }
+    const uint8_t *in = matched.data();
+    for (size_t bucket = 0; bucket < bucket_count; ++bucket)
+    {
+        size_t bucket_total = 0;
+        if (facet.field == FacetDefinition::Field::STATUS)
+        {
+            const DocumentStatus status = static_cast<DocumentStatus>(bucket);
+            const DocumentStatus *statuses = statuses_.data();
+            for (size_t i = 0; i < count; ++i)
+            {
+                bucket_total += in[i] & static_cast<uint8_t>(statuses[i] == status);
+            }
+        }
+        else
+        {
+            const int min_rating = facet.rating_ranges[bucket].min;
+            const int max_rating = facet.rating_ranges[bucket].max;
+            const int *ratings = ratings_.data();
+            for (size_t i = 0; i < count; ++i)
+            {
+                bucket_total += in[i] & static_cast<uint8_t>((ratings[i] >= min_rating) & (ratings[i] <= max_rating));
+            }
+        }
+        counts[bucket] = bucket_total;
+    }
+    return counts;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+
+struct NumericRange
+{
+    std::string field;
+    double min = -std::numeric_limits<double>::infinity();
+    double max = std::numeric_limits<double>::infinity();
+};
+
+// Declarative document filter, evaluated over attribute columns before scoring
+struct DocumentFilter
+{
+    std::optional<DocumentStatus> status;
+    int min_rating = std::numeric_limits<int>::min();
+    int max_rating = std::numeric_limits<int>::max();
+    std::vector<NumericRange> numeric_ranges;
+};
+
+struct RatingRange
+{
+    int min = std::numeric_limits<int>::min();
+    int max = std::numeric_limits<int>::max();
+};
+
+// One facet of a result: a status facet has a bucket per DocumentStatus, in enum order;
+// a rating facet has a bucket per range (ranges are inclusive and may overlap)
+struct FacetDefinition
+{
+    enum class Field
+    {
+        STATUS,
+        RATING,
+    };
+
+    Field field = Field::STATUS;
+    std::vector<RatingRange> rating_ranges;
+};
+
+struct FacetedResult
+{
+    std::vector<Document> documents;
+    // Matched documents that pass the filter, of which documents is the top
+    size_t matched_documents = 0;
+    // Bucket counts of each requested facet, in request order
+    std::vector<std::vector<size_t>> facet_counts;
+};
+
+// A DocumentFilter bound to the attribute columns. Built by DocumentAttributes::MakeMask, either
+// as a byte per ordinal (when most documents will be checked) or as a check of the columns of one
+// ordinal at a time (when only a few postings will be). Valid while the attributes are not modified
+class DocumentMask
+{
+public:
+    bool Accepts(uint32_t ordinal) const
+    {
+        if (is_materialized_)
+        {
+            return bytes_[ordinal] != 0;
+        }
+        if (rejects_all_ || !alive_[ordinal])
+        {
+            return false;
+        }
+        if (statuses_ != nullptr && statuses_[ordinal] != status_)
+        {
+            return false;
+        }
+        if (ratings_ != nullptr && (ratings_[ordinal] < min_rating_ || ratings_[ordinal] > max_rating_))
+        {
+            return false;
+        }
+        for (const NumericColumnRange &range : numeric_ranges_)
+        {
+            // NaN (field not set) fails both comparisons
+            if (!(range.values[ordinal] >= range.min && range.values[ordinal] <= range.max))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    friend class DocumentAttributes;
+
+    struct NumericColumnRange
+    {
+        const double *values;
+        double min;
+        double max;
+    };
+
+    bool is_materialized_ = false;
+    std::vector<uint8_t> bytes_;
+
+    bool rejects_all_ = false;
+    const uint8_t *alive_ = nullptr;
+    const DocumentStatus *statuses_ = nullptr;
+    DocumentStatus status_ = DocumentStatus::ACTUAL;
+    const int *ratings_ = nullptr;
+    int min_rating_ = 0;
+    int max_rating_ = 0;
+    std::vector<NumericColumnRange> numeric_ranges_;
+};
+
+// Document attributes stored column by column and indexed by internal ordinal.
+// Removed documents keep their ordinal and are only marked as dead.
+class DocumentAttributes
+{
+public:
+    uint32_t Add(int document_id, int rating, DocumentStatus status, uint32_t length);
+
+    void Remove(uint32_t ordinal);
+
+    void SetNumericField(uint32_t ordinal, std::string_view field, double value);
+
+    // Rebuilds the columns so that new ordinal i holds the document of old ordinal order[i].
+    // Ordinals missing from order are dropped
+    void Reorder(const std::vector<uint32_t> &order);
+
+    // One byte per ordinal: 1 if a live document passes the filter
+    std::vector<uint8_t> Evaluate(const DocumentFilter &filter) const;
+
+    // expected_checks is roughly how many ordinals the query will test. Evaluate costs a pass over
+    // every ordinal, so it is only used when that is a sizeable fraction of the documents
+    DocumentMask MakeMask(const DocumentFilter &filter, size_t expected_checks) const;
+
+    // Bucket counts of the facet over the given documents
+    std::vector<size_t> CountFacet(const std::vector<uint32_t> &ordinals, const FacetDefinition &facet) const;
+
+    size_t size() const
+    {
+        return ids_.size();
+    }
+
+    int GetId(uint32_t ordinal) const
+    {
+        return ids_[ordinal];
+    }
+
+    int GetRating(uint32_t ordinal) const
+    {
+        return ratings_[ordinal];
+    }
+
+    DocumentStatus GetStatus(uint32_t ordinal) const
+    {
+        return statuses_[ordinal];
+    }
+
+    DocumentData Get(uint32_t ordinal) const
+    {
+        return {ratings_[ordinal], statuses_[ordinal]};
+    }
+
+    // Number of indexed (non-stop) words, used for length normalization
+    uint32_t GetLength(uint32_t ordinal) const
+    {
+        return lengths_[ordinal];
+    }
+
+    double GetAverageLength() const;
+
+    // Approximate heap bytes of all columns
+    size_t GetMemoryUsage() const;
+
+private:
+    std::vector<int> ids_;
+    std::vector<int> ratings_;
+    std::vector<DocumentStatus> statuses_;
+    std::vector<uint32_t> lengths_;
+    std::vector<uint8_t> alive_;
+    size_t alive_count_ = 0;
+    uint64_t alive_length_sum_ = 0;
+    std::map<std::string, std::vector<double>, std::less<>> numeric_fields_;
+
+    static constexpr size_t STATUS_COUNT = 4;
+    // CountFacet switches to a byte mask once the matched set exceeds 1/DENSE_FACET_RATIO of the documents
+    static constexpr size_t DENSE_FACET_RATIO = 16;
+    // MakeMask materializes the filter once a query checks more than 1/MASK_MATERIALIZE_RATIO of the documents
+    static constexpr size_t MASK_MATERIALIZE_RATIO = 8;
+};
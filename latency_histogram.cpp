@@ -0,0 +1,119 @@
+#include "latency_histogram.h"
+
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+namespace
+{
+// Index of the highest set bit, value must not be zero
+size_t HighestBit(uint64_t value)
+{
+    size_t bit = 0;
+    for (size_t shift = 32; shift > 0; shift /= 2)
+    {
+        if (value >> shift)
+        {
+            value >>= shift;
+            bit += shift;
+        }
+    }
+    return bit;
+}
+} // namespace
+
+size_t LatencyHistogram::GetBucketIndex(uint64_t value)
+{
+    if (value < SUB_BUCKET_COUNT)
+    {
+        return static_cast<size_t>(value);
+    }
+    const size_t exponent = HighestBit(value);
+    const size_t sub_bucket = static_cast<size_t>(value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + sub_bucket;
+}
+
+uint64_t LatencyHistogram::GetBucketUpperBound(size_t index)
+{
+    if (index < SUB_BUCKET_COUNT)
+    {
+        return index;
+    }
+    const size_t exponent = index / SUB_BUCKET_COUNT + SUB_BUCKET_BITS - 1;
+    const uint64_t sub_bucket = index % SUB_BUCKET_COUNT;
+    const uint64_t width = uint64_t{1} << (exponent - SUB_BUCKET_BITS);
+    return (SUB_BUCKET_COUNT + sub_bucket) * width + (width - 1);
+}
+
+void LatencyHistogram::Record(uint64_t nanoseconds)
+{
+    counts_[GetBucketIndex(nanoseconds)].fetch_add(1, memory_order_relaxed);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other)
+{
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+    {
+        const uint64_t count = other.GetBucketCount(i);
+        if (count != 0)
+        {
+            counts_[i].fetch_add(count, memory_order_relaxed);
+        }
+    }
+}
+
+void LatencyHistogram::Reset()
+{
+    for (auto &count : counts_)
+    {
+        count.store(0, memory_order_relaxed);
+    }
+}
+
+uint64_t LatencyHistogram::GetCount() const
+{
+    uint64_t total = 0;
+    for (const auto &count : counts_)
+    {
+        total += count.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t LatencyHistogram::GetPercentile(double percentile) const
+{
+    const uint64_t total = GetCount();
+    if (total == 0)
+    {
+        return 0;
+    }
+    // Rank of the requested sample, counted from 1
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * total + 0.5);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+    {
+        seen += counts_[i].load(memory_order_relaxed);
+        if (seen >= rank)
+        {
+            return GetBucketUpperBound(i);
+        }
+    }
+    return GetMax();
+}
+
+uint64_t LatencyHistogram::GetMax() const
+{
+    for (size_t i = BUCKET_COUNT; i > 0; --i)
+    {
+        if (counts_[i - 1].load(memory_order_relaxed) != 0)
+        {
+            return GetBucketUpperBound(i - 1);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// HDR-style histogram of nanosecond latencies: every power of two is split into
+// SUB_BUCKET_COUNT linear sub-buckets, which bounds the relative error by 1/SUB_BUCKET_COUNT.
+// Recording is a single relaxed atomic increment, so one histogram can be shared by many threads.
+class LatencyHistogram
+{
+public:
+    void Record(uint64_t nanoseconds);
+
+    // Adds the counts of other into this histogram
+    void Merge(const LatencyHistogram &other);
+
+    void Reset();
+
+    uint64_t GetCount() const;
+
+    // Upper bound of the bucket holding the given percentile (0..100), 0 if nothing was recorded
+    uint64_t GetPercentile(double percentile) const;
+
+    uint64_t GetMax() const;
+
+    static constexpr size_t SUB_BUCKET_BITS = 3;
+    static constexpr size_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+    static size_t GetBucketIndex(uint64_t value);
+
+    static uint64_t GetBucketUpperBound(size_t index);
+
+    uint64_t GetBucketCount(size_t index) const
+    {
+        return counts_[index].load(std::memory_order_relaxed);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> counts_{};
+};
@@ -1,6 +1,12 @@
+#include "mutation_log.h"
 #include "search_server.h"
 
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <random>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <cassert>
@@ -41,4 +47,109 @@ int main() {
         assert(result[0].id == 7); 
         assert(result[1].id == 8);
     }
+
+    {
+        PreparedQuery query = search_server.PrepareQuery("большой -кот"); // Запрос разбирается один раз и может выполняться многократно
+
+        assert(search_server.FindTopDocuments(query).size() == 2);
+
+        search_server.RemoveDocument(5); // После изменения индекса запрос перестраивается автоматически
+        auto result = search_server.FindTopDocuments(query);
+        assert(result.size() == 1);
+        assert(result[0].id == 4);
+    }
+
+    {
+        PreparedQuery query = search_server.PrepareQuery("большой -кот");
+        SearchServer other_server(stop_words);
+        other_server.AddDocument(7, "пушистый пёс"s, DocumentStatus::ACTUAL, {1});
+        assert(other_server.FindTopDocuments(query).empty()); // На другом сервере запрос разбирается заново
+        SearchServer server_copy = search_server;
+        assert(server_copy.FindTopDocuments(query).size() == 1); // Как и на копии сервера
+    }
+
+    {
+        SearchServer reordered_server("x"s);
+        reordered_server.AddDocument(1, "x x"s, DocumentStatus::ACTUAL, {1}); // Документ только из стоп-слов
+        reordered_server.AddDocument(2, "пушистый кот"s, DocumentStatus::ACTUAL, {2});
+        reordered_server.AddDocument(3, "пушистый пёс"s, DocumentStatus::ACTUAL, {3});
+        reordered_server.ReorderDocuments(); // Меняет только внутреннюю нумерацию документов
+        assert(reordered_server.GetDocumentCount() == 3);
+        auto result = reordered_server.FindTopDocuments("пушистый");
+        assert(result.size() == 2);
+        assert(result[0].id == 3);
+        assert(result[1].id == 2);
+    }
+
+    {
+        std::mt19937 generator(42);
+        const auto random_word = [&generator] { return "w"s + std::to_string(generator() % 60); };
+        SearchServer batch_server("w0"s);
+        for (int id = 0; id < 2000; ++id)
+        {
+            std::string text = random_word();
+            for (int i = generator() % 12; i > 0; --i)
+            {
+                text += " "s + random_word();
+            }
+            batch_server.AddDocument(id, text, static_cast<DocumentStatus>(generator() % 4 == 0), {static_cast<int>(generator() % 10)});
+        }
+        std::vector<std::string> queries;
+        for (int i = 0; i < 300; ++i)
+        {
+            std::string query = random_word() + " "s + random_word();
+            if (generator() % 3 == 0) query += " -"s + random_word();
+            if (generator() % 10 == 0) query += " +"s + random_word();
+            if (generator() % 15 == 0) query += " w1*"s;
+            queries.push_back(query);
+        }
+        const auto batch_results = batch_server.FindTopDocumentsBatch(queries); // Пакетный поиск выдаёт то же, что и поиск по одному запросу
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            const auto expected = batch_server.FindTopDocuments(queries[i]);
+            assert(batch_results[i].size() == expected.size());
+            for (size_t j = 0; j < expected.size(); ++j)
+            {
+                assert(batch_results[i][j].id == expected[j].id);
+                assert(batch_results[i][j].relevance == expected[j].relevance);
+            }
+        }
+
+        queries.push_back("--bad"s);
+        bool is_rejected = false;
+        try
+        {
+            batch_server.FindTopDocumentsBatch(queries); // Некорректный запрос в пакете приводит к исключению, а не к аварийному завершению
+        }
+        catch (const std::invalid_argument &)
+        {
+            is_rejected = true;
+        }
+        assert(is_rejected);
+    }
+
+    {
+        const std::string log_path = (std::filesystem::temp_directory_path() / "search_server_demo.log").string();
+        std::remove(log_path.c_str());
+        std::remove((log_path + ".checkpoint").c_str());
+        {
+            SearchServer logged_server(stop_words);
+            MutationLog log(logged_server, log_path, FsyncPolicy::ALWAYS);
+            log.AddDocument(1, "пушистый кот пушистый хвост"s, DocumentStatus::ACTUAL, {7, 2, 7});
+            log.AddDocument(2, "пушистый пёс и модный ошейник"s, DocumentStatus::ACTUAL, {1, 2, 3});
+            log.Checkpoint(); // Документы 1 и 2 переносятся в снимок, журнал очищается
+            log.AddDocument(3, "большой кот модный ошейник "s, DocumentStatus::ACTUAL, {1, 2, 8});
+            log.RemoveDocument(1);
+        }
+        {
+            std::ofstream log_file(log_path, std::ios::binary | std::ios::app);
+            log_file.write("\x40\0\0\0\0\0\0\0torn", 12); // Запись, оборванная сбоем посреди записи на диск
+        }
+        SearchServer restored_server(stop_words);
+        MutationLog log(restored_server, log_path); // Снимок и журнал воспроизводятся, оборванный хвост отбрасывается
+        assert(log.GetReplayedCount() == 2);
+        auto result = restored_server.FindTopDocuments("модный ошейник");
+        assert(result.size() == 2);
+        assert(restored_server.FindTopDocuments("хвост").empty());
+    }
 }
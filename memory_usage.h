@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Approximate heap bytes held by the index, by structure. Container sizes are estimated from
+// capacities and a fixed per-node overhead, not measured through the allocator.
+struct MemoryUsage
+{
+    // Word storage, word -> term id map, term id -> word table and the term trie
+    size_t dictionary = 0;
+    // Posting lists
+    size_t inverted_index = 0;
+    // Word positions, zero unless the positional index is enabled
+    size_t positional_index = 0;
+    // Per-document word frequencies (GetWordFrequencies)
+    size_t forward_index = 0;
+    // Attribute columns, document id sets and maps
+    size_t document_metadata = 0;
+
+    size_t GetTotal() const
+    {
+        return dictionary + inverted_index + positional_index + forward_index + document_metadata;
+    }
+};
+
+// Red-black tree node header of std::map/std::set: colour plus three pointers
+const size_t TREE_NODE_OVERHEAD = 4 * sizeof(void *);
+
+template <typename T>
+size_t GetVectorBytes(const std::vector<T> &values)
+{
+    return values.capacity() * sizeof(T);
+}
+
+// Heap part of a string; short strings live inside the object
+inline size_t GetStringBytes(const std::string &value)
+{
+    return value.capacity() > std::string().capacity() ? value.capacity() + 1 : 0;
+}
+
+// Nodes of a std::map/std::set, without anything their elements own
+template <typename Tree>
+size_t GetTreeBytes(const Tree &tree)
+{
+    return tree.size() * (TREE_NODE_OVERHEAD + sizeof(typename Tree::value_type));
+}
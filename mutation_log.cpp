@@ -0,0 +1,477 @@
+#include "mutation_log.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <execution>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+// Record: payload size (u32), CRC-32 of the payload (u32), payload. Integers are little-endian.
+// Add payload: type, id (i32), status (u8), rating count (u32), ratings (i32...), text size (u32), text.
+// Remove payload: type, id (i32).
+const size_t RECORD_HEADER_SIZE = 8;
+const uint8_t RECORD_ADD = 1;
+const uint8_t RECORD_REMOVE = 2;
+
+struct Mutation
+{
+    bool is_valid = false;
+    uint8_t type = 0;
+    int document_id = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    vector<int> ratings;
+    string text;
+};
+
+struct RecordSpan
+{
+    const string *source;
+    size_t offset;
+    size_t size;
+};
+
+const array<uint32_t, 256> &GetCrcTable()
+{
+    static const array<uint32_t, 256> table = [] {
+        array<uint32_t, 256> result{};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+            }
+            result[i] = crc;
+        }
+        return result;
+    }();
+    return table;
+}
+
+uint32_t ComputeCrc32(const char *data, size_t size)
+{
+    const array<uint32_t, 256> &table = GetCrcTable();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+void PutU32(string &out, uint32_t value)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        out.push_back(static_cast<char>((value >> shift) & 0xFF));
+    }
+}
+
+uint32_t GetU32(const char *data)
+{
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i)
+    {
+        value = (value << 8) | static_cast<uint8_t>(data[i]);
+    }
+    return value;
+}
+
+string MakeRecord(const string &payload)
+{
+    string record;
+    record.reserve(RECORD_HEADER_SIZE + payload.size());
+    PutU32(record, static_cast<uint32_t>(payload.size()));
+    PutU32(record, ComputeCrc32(payload.data(), payload.size()));
+    record += payload;
+    return record;
+}
+
+string MakeAddRecord(int document_id, string_view document, DocumentStatus status, const vector<int> &ratings)
+{
+    string payload;
+    payload.reserve(14 + ratings.size() * 4 + document.size());
+    payload.push_back(static_cast<char>(RECORD_ADD));
+    PutU32(payload, static_cast<uint32_t>(document_id));
+    payload.push_back(static_cast<char>(status));
+    PutU32(payload, static_cast<uint32_t>(ratings.size()));
+    for (const int rating : ratings)
+    {
+        PutU32(payload, static_cast<uint32_t>(rating));
+    }
+    PutU32(payload, static_cast<uint32_t>(document.size()));
+    payload.append(document.data(), document.size());
+    return MakeRecord(payload);
+}
+
+string MakeRemoveRecord(int document_id)
+{
+    string payload;
+    payload.push_back(static_cast<char>(RECORD_REMOVE));
+    PutU32(payload, static_cast<uint32_t>(document_id));
+    return MakeRecord(payload);
+}
+
+// Leaves is_valid false for a damaged record
+Mutation DecodeRecord(const RecordSpan &span)
+{
+    Mutation mutation;
+    const char *header = span.source->data() + span.offset;
+    const char *data = header + RECORD_HEADER_SIZE;
+    const size_t size = span.size - RECORD_HEADER_SIZE;
+    if (size < 5 || ComputeCrc32(data, size) != GetU32(header + 4))
+    {
+        return mutation;
+    }
+    mutation.type = static_cast<uint8_t>(data[0]);
+    mutation.document_id = static_cast<int>(GetU32(data + 1));
+    if (mutation.type == RECORD_REMOVE)
+    {
+        mutation.is_valid = size == 5;
+        return mutation;
+    }
+    if (mutation.type != RECORD_ADD || size < 14)
+    {
+        return mutation;
+    }
+    mutation.status = static_cast<DocumentStatus>(data[5]);
+    const size_t rating_count = GetU32(data + 6);
+    size_t position = 10;
+    if (rating_count > (size - position - 4) / 4)
+    {
+        return mutation;
+    }
+    mutation.ratings.reserve(rating_count);
+    for (size_t i = 0; i < rating_count; ++i, position += 4)
+    {
+        mutation.ratings.push_back(static_cast<int>(GetU32(data + position)));
+    }
+    const size_t text_size = GetU32(data + position);
+    position += 4;
+    if (text_size != size - position)
+    {
+        return mutation;
+    }
+    mutation.text.assign(data + position, text_size);
+    mutation.is_valid = true;
+    return mutation;
+}
+
+string ReadFile(const string &path)
+{
+    ifstream in(path, ios::binary);
+    return in ? string(istreambuf_iterator<char>(in), istreambuf_iterator<char>()) : string();
+}
+
+// Splits `source` into records; returns the size of the complete prefix (a crash may tear the tail)
+size_t SplitRecords(const string &source, vector<RecordSpan> &spans)
+{
+    size_t offset = 0;
+    while (source.size() - offset >= RECORD_HEADER_SIZE)
+    {
+        const size_t size = RECORD_HEADER_SIZE + GetU32(source.data() + offset);
+        if (source.size() - offset < size)
+        {
+            break;
+        }
+        spans.push_back({&source, offset, size});
+        offset += size;
+    }
+    return offset;
+}
+
+// Documents alive after applying the checkpoint and then the log, in the order they were added.
+// Records are decoded and checksummed in parallel, one task per record. `log_size` receives the
+// length of the undamaged prefix of the log.
+vector<Mutation> ReadAliveDocuments(const string &checkpoint, const string &log, size_t &log_size)
+{
+    vector<RecordSpan> spans;
+    SplitRecords(checkpoint, spans);
+    const size_t checkpoint_records = spans.size();
+    log_size = SplitRecords(log, spans);
+
+    vector<Mutation> mutations(spans.size());
+    vector<size_t> indexes(spans.size());
+    iota(indexes.begin(), indexes.end(), 0);
+    for_each(execution::par, indexes.begin(), indexes.end(),
+             [&](size_t index) { mutations[index] = DecodeRecord(spans[index]); });
+
+    // Last mutation of a document wins. An add over an alive document only happens when a crash hit
+    // between writing the checkpoint and emptying the log, so it replaces the earlier copy.
+    map<int, size_t> alive;
+    for (size_t i = 0; i < mutations.size(); ++i)
+    {
+        if (!mutations[i].is_valid)
+        {
+            if (i < checkpoint_records)
+            {
+                throw runtime_error("Checkpoint is damaged"s);
+            }
+            // Nothing after a damaged record can be trusted
+            log_size = spans[i].offset;
+            mutations.resize(i);
+            break;
+        }
+        if (mutations[i].type == RECORD_ADD)
+        {
+            alive[mutations[i].document_id] = i;
+        }
+        else
+        {
+            alive.erase(mutations[i].document_id);
+        }
+    }
+
+    vector<size_t> order;
+    order.reserve(alive.size());
+    for (const auto &[document_id, index] : alive)
+    {
+        order.push_back(index);
+    }
+    sort(order.begin(), order.end());
+    vector<Mutation> result;
+    result.reserve(order.size());
+    for (const size_t index : order)
+    {
+        result.push_back(move(mutations[index]));
+    }
+    return result;
+}
+
+void ThrowSystemError(const string &what)
+{
+    throw system_error(errno, generic_category(), what);
+}
+
+// Returns an error description instead of throwing, since it runs on the flusher thread
+string WriteAll(int fd, const string &data, bool sync)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        const ssize_t result = write(fd, data.data() + written, data.size() - written);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return "Mutation log write failed: "s + strerror(errno);
+        }
+        written += static_cast<size_t>(result);
+    }
+    if (sync && fdatasync(fd) != 0)
+    {
+        return "Mutation log sync failed: "s + strerror(errno);
+    }
+    return {};
+}
+
+void SyncDirectory(const string &path)
+{
+    const size_t slash = path.rfind('/');
+    const string directory = slash == string::npos ? "."s : slash == 0 ? "/"s : path.substr(0, slash);
+    const int fd = open(directory.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
+} // namespace
+
+MutationLog::MutationLog(SearchServer &search_server, string path, FsyncPolicy policy,
+                         chrono::milliseconds flush_interval)
+    : server_(search_server), path_(move(path)), checkpoint_path_(path_ + ".checkpoint"), policy_(policy),
+      flush_interval_(flush_interval)
+{
+    Replay();
+    fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0)
+    {
+        ThrowSystemError("Can't open mutation log "s + path_);
+    }
+    flusher_ = thread([this] { RunFlusher(); });
+}
+
+MutationLog::~MutationLog()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        is_stopping_ = true;
+    }
+    flush_requested_.notify_one();
+    flusher_.join();
+    close(fd_);
+}
+
+void MutationLog::AddDocument(int document_id, string_view document, DocumentStatus status,
+                              const vector<int> &ratings)
+{
+    const string record = MakeAddRecord(document_id, document, status, ratings);
+    uint64_t sequence = 0;
+    {
+        // Only mutations the server accepted are logged, so replay never meets an invalid one
+        lock_guard<mutex> writer_lock(writer_mutex_);
+        server_.AddDocument(document_id, document, status, ratings);
+        sequence = Append(record);
+    }
+    WaitAppended(sequence);
+}
+
+void MutationLog::RemoveDocument(int document_id)
+{
+    uint64_t sequence = 0;
+    {
+        lock_guard<mutex> writer_lock(writer_mutex_);
+        server_.RemoveDocument(document_id);
+        sequence = Append(MakeRemoveRecord(document_id));
+    }
+    WaitAppended(sequence);
+}
+
+void MutationLog::Flush()
+{
+    unique_lock<mutex> lock(mutex_);
+    WaitDurable(lock, appended_sequence_);
+}
+
+void MutationLog::Checkpoint()
+{
+    Flush();
+    unique_lock<mutex> lock(mutex_);
+    // A batch the flusher is writing now would be torn by the truncation below
+    flushed_.wait(lock, [&] { return !is_writing_; });
+    size_t log_size = 0;
+    const vector<Mutation> alive = ReadAliveDocuments(ReadFile(checkpoint_path_), ReadFile(path_), log_size);
+
+    const string temporary_path = checkpoint_path_ + ".tmp";
+    const int fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        ThrowSystemError("Can't create checkpoint "s + temporary_path);
+    }
+    string data;
+    for (const Mutation &mutation : alive)
+    {
+        data += MakeAddRecord(mutation.document_id, mutation.text, mutation.status, mutation.ratings);
+    }
+    const string error = WriteAll(fd, data, true);
+    close(fd);
+    if (!error.empty())
+    {
+        throw runtime_error(error);
+    }
+    // The new checkpoint replaces the old one atomically; until the log is emptied below,
+    // replay sees both and the last-mutation-wins rule keeps the result the same
+    if (rename(temporary_path.c_str(), checkpoint_path_.c_str()) != 0)
+    {
+        ThrowSystemError("Can't replace checkpoint "s + checkpoint_path_);
+    }
+    SyncDirectory(checkpoint_path_);
+    if (ftruncate(fd_, 0) != 0 || fdatasync(fd_) != 0)
+    {
+        ThrowSystemError("Can't truncate mutation log "s + path_);
+    }
+}
+
+uint64_t MutationLog::Append(const string &record)
+{
+    lock_guard<mutex> lock(mutex_);
+    if (!write_error_.empty())
+    {
+        throw runtime_error(write_error_);
+    }
+    pending_ += record;
+    return ++appended_sequence_;
+}
+
+// Runs after the writer lock is released, so other writers keep appending to the batch this one waits for
+void MutationLog::WaitAppended(uint64_t sequence)
+{
+    if (policy_ == FsyncPolicy::ALWAYS)
+    {
+        unique_lock<mutex> lock(mutex_);
+        WaitDurable(lock, sequence);
+    }
+}
+
+void MutationLog::WaitDurable(unique_lock<mutex> &lock, uint64_t sequence)
+{
+    ++flush_waiters_;
+    flush_requested_.notify_one();
+    flushed_.wait(lock, [&] { return durable_sequence_ >= sequence || !write_error_.empty(); });
+    --flush_waiters_;
+    if (!write_error_.empty())
+    {
+        throw runtime_error(write_error_);
+    }
+}
+
+// Group commit: whatever was appended while the previous batch was being written goes out
+// in the next write, with a single sync for all of it
+void MutationLog::RunFlusher()
+{
+    unique_lock<mutex> lock(mutex_);
+    while (true)
+    {
+        flush_requested_.wait_for(lock, flush_interval_,
+                                  [&] { return is_stopping_ || (flush_waiters_ > 0 && !pending_.empty()); });
+        if (pending_.empty())
+        {
+            if (is_stopping_)
+            {
+                return;
+            }
+            continue;
+        }
+        string batch;
+        batch.swap(pending_);
+        const uint64_t sequence = appended_sequence_;
+        is_writing_ = true;
+
+        lock.unlock();
+        const string error = WriteAll(fd_, batch, policy_ != FsyncPolicy::NEVER);
+        lock.lock();
+
+        if (!error.empty())
+        {
+            write_error_ = error;
+        }
+        is_writing_ = false;
+        durable_sequence_ = sequence;
+        flushed_.notify_all();
+    }
+}
+
+void MutationLog::Replay()
+{
+    const string log = ReadFile(path_);
+    size_t log_size = 0;
+    const vector<Mutation> alive = ReadAliveDocuments(ReadFile(checkpoint_path_), log, log_size);
+    // Index insertion stays sequential: SearchServer has a single writer
+    for (const Mutation &mutation : alive)
+    {
+        server_.AddDocument(mutation.document_id, mutation.text, mutation.status, mutation.ratings);
+    }
+    replayed_count_ = alive.size();
+    if (log_size < log.size() && truncate(path_.c_str(), static_cast<off_t>(log_size)) != 0)
+    {
+        ThrowSystemError("Can't cut the damaged tail of mutation log "s + path_);
+    }
+}
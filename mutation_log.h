@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+
+enum class FsyncPolicy
+{
+    // Every mutation waits until its record is on disk; concurrent mutations share one fsync
+    ALWAYS,
+    // Mutations return once the record is buffered; a background thread writes and syncs every interval
+    PERIODIC,
+    // Records are written every interval but never synced, so durability is up to the OS
+    NEVER,
+};
+
+// Durable front end for SearchServer mutations. Every successful AddDocument/RemoveDocument is
+// appended to a binary write-ahead log at `path`; Checkpoint() compacts the log into
+// `path`.checkpoint. Constructing a MutationLog over an empty server replays the checkpoint and
+// the log, so the server ends up with the documents it had before the restart.
+class MutationLog
+{
+public:
+    MutationLog(SearchServer &search_server, std::string path, FsyncPolicy policy = FsyncPolicy::PERIODIC,
+                std::chrono::milliseconds flush_interval = std::chrono::milliseconds(10));
+
+    MutationLog(const MutationLog &) = delete;
+    MutationLog &operator=(const MutationLog &) = delete;
+
+    // Flushes everything still buffered
+    ~MutationLog();
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status,
+                     const std::vector<int> &ratings);
+
+    void RemoveDocument(int document_id);
+
+    // Blocks until every record appended so far is written and, unless the policy is NEVER, synced
+    void Flush();
+
+    // Rewrites the checkpoint with the documents alive now and empties the log
+    void Checkpoint();
+
+    // Documents restored by the constructor
+    size_t GetReplayedCount() const
+    {
+        return replayed_count_;
+    }
+
+private:
+    SearchServer &server_;
+    const std::string path_;
+    const std::string checkpoint_path_;
+    const FsyncPolicy policy_;
+    const std::chrono::milliseconds flush_interval_;
+    int fd_ = -1;
+    size_t replayed_count_ = 0;
+
+    // Held across applying a mutation and appending its record, so the log order is the apply order
+    // and the server has a single writer. Taken before mutex_, never while waiting for a sync
+    std::mutex writer_mutex_;
+    std::mutex mutex_;
+    std::condition_variable flush_requested_;
+    // Signalled after every batch, when durable_sequence_ advances and is_writing_ drops
+    std::condition_variable flushed_;
+    // Records appended but not yet handed to the flusher
+    std::string pending_;
+    uint64_t appended_sequence_ = 0;
+    uint64_t durable_sequence_ = 0;
+    size_t flush_waiters_ = 0;
+    // The flusher is writing a batch with mutex_ released
+    bool is_writing_ = false;
+    bool is_stopping_ = false;
+    std::string write_error_;
+    std::thread flusher_;
+
+    // Returns the sequence number of the record
+    uint64_t Append(const std::string &record);
+
+    // Under FsyncPolicy::ALWAYS, blocks until the record with this sequence number is synced
+    void WaitAppended(uint64_t sequence);
+
+    void WaitDurable(std::unique_lock<std::mutex> &lock, uint64_t sequence);
+
+    void RunFlusher();
+
+    void Replay();
+};
@@ -0,0 +1,135 @@
+#include "positional_index.h"
+#include "memory_usage.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+void PositionalIndex::Add(size_t term_id, const vector<uint32_t> &positions)
+{
+    if (term_to_positions_.size() <= term_id)
+    {
+        term_to_positions_.resize(term_id + 1);
+    }
+    TermPositions &term = term_to_positions_[term_id];
+    term.offsets.push_back(static_cast<uint32_t>(term.bytes.size()));
+    EncodePositions(positions, term.bytes);
+}
+
+void PositionalIndex::Remove(size_t term_id, size_t posting_index)
+{
+    TermPositions &term = term_to_positions_[term_id];
+    const uint32_t begin = term.offsets[posting_index];
+    const uint32_t end = posting_index + 1 < term.offsets.size() ? term.offsets[posting_index + 1]
+                                                                 : static_cast<uint32_t>(term.bytes.size());
+    term.bytes.erase(term.bytes.begin() + begin, term.bytes.begin() + end);
+    term.offsets.erase(term.offsets.begin() + posting_index);
+    for (size_t i = posting_index; i < term.offsets.size(); ++i)
+    {
+        term.offsets[i] -= end - begin;
+    }
+}
+
+vector<uint32_t> PositionalIndex::GetPositions(size_t term_id, size_t posting_index) const
+{
+    const TermPositions &term = term_to_positions_[term_id];
+    const size_t end = posting_index + 1 < term.offsets.size() ? term.offsets[posting_index + 1] : term.bytes.size();
+    return DecodePositions(term.bytes.data() + term.offsets[posting_index], term.bytes.data() + end);
+}
+
+void PositionalIndex::Permute(size_t term_id, const vector<uint32_t> &order)
+{
+    if (term_id >= term_to_positions_.size())
+    {
+        return;
+    }
+    TermPositions &term = term_to_positions_[term_id];
+    TermPositions permuted;
+    permuted.bytes.reserve(term.bytes.size());
+    permuted.offsets.reserve(term.offsets.size());
+    for (const uint32_t index : order)
+    {
+        const size_t end = index + 1 < term.offsets.size() ? term.offsets[index + 1] : term.bytes.size();
+        permuted.offsets.push_back(static_cast<uint32_t>(permuted.bytes.size()));
+        permuted.bytes.insert(permuted.bytes.end(), term.bytes.begin() + term.offsets[index], term.bytes.begin() + end);
+    }
+    term = move(permuted);
+}
+
+size_t PositionalIndex::GetMemoryUsage() const
+{
+    size_t bytes = GetVectorBytes(term_to_positions_);
+    for (const TermPositions &term : term_to_positions_)
+    {
+        bytes += GetVectorBytes(term.bytes) + GetVectorBytes(term.offsets);
+    }
+    return bytes;
+}
+
+void EncodePositions(const vector<uint32_t> &positions, vector<uint8_t> &bytes)
+{
+    uint32_t previous = 0;
+    for (const uint32_t position : positions)
+    {
+        uint32_t delta = position - previous;
+        previous = position;
+        while (delta >= 0x80)
+        {
+            bytes.push_back(static_cast<uint8_t>(delta | 0x80));
+            delta >>= 7;
+        }
+        bytes.push_back(static_cast<uint8_t>(delta));
+    }
+}
+
+vector<uint32_t> DecodePositions(const uint8_t *begin, const uint8_t *end)
+{
+    vector<uint32_t> positions;
+    uint32_t previous = 0;
+    uint32_t delta = 0;
+    int shift = 0;
+    for (const uint8_t *byte = begin; byte != end; ++byte)
+    {
+        delta |= static_cast<uint32_t>(*byte & 0x7F) << shift;
+        if (*byte & 0x80)
+        {
+            shift += 7;
+            continue;
+        }
+        previous += delta;
+        positions.push_back(previous);
+        delta = 0;
+        shift = 0;
+    }
+    return positions;
+}
+
+bool MatchesPhrase(const vector<vector<uint32_t>> &positions, uint32_t slop)
+{
+    if (positions.empty())
+    {
+        return false;
+    }
+    // Positions of the current word that can end a valid prefix of the phrase
+    vector<uint32_t> reachable = positions[0];
+    for (size_t i = 1; i < positions.size() && !reachable.empty(); ++i)
+    {
+        vector<uint32_t> next;
+        auto prev = reachable.begin();
+        for (const uint32_t position : positions[i])
+        {
+            while (prev != reachable.end() && *prev + 1 + slop < position)
+            {
+                ++prev;
+            }
+            if (prev != reachable.end() && *prev < position)
+            {
+                next.push_back(position);
+            }
+        }
+        reachable = move(next);
+    }
+    return !reachable.empty();
+}
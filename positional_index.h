@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Optional extension of the inverted index: word positions of every (term, document) pair,
+// stored as varint-encoded deltas and decoded only for phrase candidates. Each term keeps one byte
+// buffer and one offset per posting, so entries are addressed by their index in the term's posting
+// list and follow its order
+class PositionalIndex
+{
+public:
+    // The entry becomes the last of the term; postings of a new document are appended the same way
+    void Add(size_t term_id, const std::vector<uint32_t> &positions);
+
+    void Remove(size_t term_id, size_t posting_index);
+
+    std::vector<uint32_t> GetPositions(size_t term_id, size_t posting_index) const;
+
+    // Reorders the term's entries after its posting list: entry i becomes the old entry order[i]
+    void Permute(size_t term_id, const std::vector<uint32_t> &order);
+
+    // Approximate heap bytes of the stored positions
+    size_t GetMemoryUsage() const;
+
+private:
+    struct TermPositions
+    {
+        std::vector<uint8_t> bytes;
+        // Start of every entry in bytes; an entry ends where the next one starts
+        std::vector<uint32_t> offsets;
+    };
+
+    std::vector<TermPositions> term_to_positions_;
+};
+
+// Appends the encoded positions to bytes
+void EncodePositions(const std::vector<uint32_t> &positions, std::vector<uint8_t> &bytes);
+
+std::vector<uint32_t> DecodePositions(const uint8_t *begin, const uint8_t *end);
+
+// True if the words occur in the given order with at most slop other words between neighbours.
+// positions[i] holds the sorted positions of the i-th phrase word
+bool MatchesPhrase(const std::vector<std::vector<uint32_t>> &positions, uint32_t slop);
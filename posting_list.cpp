@@ -0,0 +1,134 @@
+#include "posting_list.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+// Lists at most this many times longer than the candidates are merged instead of galloped
+const size_t MERGE_RATIO = 8;
+const size_t BLOCK_SIZE = 8;
+// Candidates between two checks of the query control
+const size_t CONTROL_BLOCK_SIZE = 1024;
+
+bool LessOrdinal(const Posting &posting, uint32_t ordinal)
+{
+    return posting.ordinal < ordinal;
+}
+
+// The first block always runs, so a query stopped before the intersection still keeps a few candidates
+bool ShouldStopAt(QueryControl *control, size_t index)
+{
+    return control != nullptr && index > 0 && index % CONTROL_BLOCK_SIZE == 0 && control->ShouldStop();
+}
+
+vector<uint32_t> GallopIntersect(const vector<uint32_t> &candidates, const PostingList &postings,
+                                  QueryControl *control)
+{
+    vector<uint32_t> result;
+    size_t position = 0;
+    for (size_t index = 0; index < candidates.size(); ++index)
+    {
+        if (ShouldStopAt(control, index))
+        {
+            break;
+        }
+        const uint32_t ordinal = candidates[index];
+        position = GallopTo(postings, position, ordinal);
+        if (position == postings.size())
+        {
+            break;
+        }
+        if (postings[position].ordinal == ordinal)
+        {
+            result.push_back(ordinal);
+        }
+    }
+    return result;
+}
+
+// Skips whole blocks of postings with one comparison against the block's last ordinal
+vector<uint32_t> BlockMergeIntersect(const vector<uint32_t> &candidates, const PostingList &postings,
+                                     QueryControl *control)
+{
+    vector<uint32_t> result;
+    size_t position = 0;
+    for (size_t index = 0; index < candidates.size(); ++index)
+    {
+        if (ShouldStopAt(control, index))
+        {
+            break;
+        }
+        const uint32_t ordinal = candidates[index];
+        while (position + BLOCK_SIZE <= postings.size() && postings[position + BLOCK_SIZE - 1].ordinal < ordinal)
+        {
+            position += BLOCK_SIZE;
+        }
+        const size_t block_end = min(position + BLOCK_SIZE, postings.size());
+        while (position < block_end && postings[position].ordinal < ordinal)
+        {
+            ++position;
+        }
+        if (position == postings.size())
+        {
+            break;
+        }
+        if (postings[position].ordinal == ordinal)
+        {
+            result.push_back(ordinal);
+        }
+    }
+    return result;
+}
+} // namespace
+
+size_t GallopTo(const PostingList &postings, size_t from, uint32_t ordinal)
+{
+    if (from >= postings.size() || postings[from].ordinal >= ordinal)
+    {
+        return from;
+    }
+    size_t step = 1;
+    size_t low = from;
+    while (low + step < postings.size() && postings[low + step].ordinal < ordinal)
+    {
+        low += step;
+        step *= 2;
+    }
+    const size_t high = min(low + step + 1, postings.size());
+    return static_cast<size_t>(lower_bound(postings.begin() + low + 1, postings.begin() + high, ordinal, LessOrdinal) -
+                               postings.begin());
+}
+
+vector<uint32_t> IntersectPostings(vector<const PostingList *> lists, QueryControl *control)
+{
+    vector<uint32_t> result;
+    if (lists.empty())
+    {
+        return result;
+    }
+    sort(lists.begin(), lists.end(),
+         [](const PostingList *lhs, const PostingList *rhs) { return lhs->size() < rhs->size(); });
+
+    result.reserve(lists.front()->size());
+    for (const Posting &posting : *lists.front())
+    {
+        result.push_back(posting.ordinal);
+    }
+    for (size_t i = 1; i < lists.size() && !result.empty(); ++i)
+    {
+        const PostingList &postings = *lists[i];
+        if (postings.size() <= result.size() * MERGE_RATIO)
+        {
+            result = BlockMergeIntersect(result, postings, control);
+        }
+        else
+        {
+            result = GallopIntersect(result, postings, control);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "query_control.h"
+
+// Postings are kept sorted by internal document ordinal
+struct Posting
+{
+    uint32_t ordinal;
+    double term_freq;
+};
+
+using PostingList = std::vector<Posting>;
+
+inline PostingList::const_iterator FindPosting(const PostingList &postings, uint32_t ordinal)
+{
+    auto it = std::lower_bound(postings.begin(), postings.end(), ordinal,
+                               [](const Posting &posting, uint32_t value) { return posting.ordinal < value; });
+    return it != postings.end() && it->ordinal == ordinal ? it : postings.end();
+}
+
+inline bool ContainsOrdinal(const PostingList &postings, uint32_t ordinal)
+{
+    return FindPosting(postings, ordinal) != postings.end();
+}
+
+// Index of the first posting at or after from whose ordinal is not less than ordinal.
+// Steps grow exponentially before the binary search, so a run of nearby lookups stays cheap
+size_t GallopTo(const PostingList &postings, size_t from, uint32_t ordinal);
+
+// Sorted ordinals present in every list. The lists are walked rarest first: the smallest one
+// gives the candidates and the others are probed by galloping (or merged block by block
+// when they are about as short as the candidate list). control (may be null) is checked between
+// blocks of candidates; once it stops, only the ordinals below the point reached are returned
+std::vector<uint32_t> IntersectPostings(std::vector<const PostingList *> lists, QueryControl *control = nullptr);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "posting_list.h"
+
+class SearchServer;
+
+// Term id of a prefix (word*) or fuzzy (word~N) query word that expanded into several terms
+const size_t EXPANDED_TERM_ID = static_cast<size_t>(-1);
+
+// Query word resolved against the index: term id and pointer to its postings.
+// An expanded word points to the union of its terms' postings, owned by the plan itself
+struct TermPlan
+{
+    size_t term_id;
+    const PostingList *postings;
+    std::shared_ptr<const PostingList> owned_postings;
+};
+
+// Quoted phrase: terms in query order, slop is the number of extra words allowed between neighbours
+struct PhrasePlan
+{
+    std::vector<TermPlan> terms;
+    uint32_t slop = 0;
+};
+
+struct QueryPlan
+{
+    std::vector<TermPlan> plus_terms;
+    std::vector<TermPlan> minus_terms;
+    // +word terms: every result must contain all of them (they are plus terms as well)
+    std::vector<TermPlan> required_terms;
+    std::vector<PhrasePlan> phrases;
+    // Some required or phrase word is absent from the index, so nothing can match
+    bool has_missing_required_term = false;
+};
+
+// Query parsed and validated once by SearchServer::PrepareQuery. The plan holds term ids and posting
+// pointers; term weights are computed on every execution. It is re-resolved lazily when the query runs on
+// another server or the server generation changes (after AddDocument/RemoveDocument),
+// so a prepared query must not be executed from several threads at once.
+class PreparedQuery
+{
+public:
+    const std::vector<std::string> &GetPlusWords() const
+    {
+        return plus_words_;
+    }
+
+    const std::vector<std::string> &GetMinusWords() const
+    {
+        return minus_words_;
+    }
+
+private:
+    friend class SearchServer;
+
+    struct Phrase
+    {
+        std::vector<std::string> words;
+        uint32_t slop = 0;
+    };
+
+    std::vector<std::string> plus_words_;
+    std::vector<std::string> minus_words_;
+    std::vector<std::string> required_words_;
+    std::vector<Phrase> phrases_;
+    QueryPlan plan_;
+    // Server the plan was resolved against, and its generation at that time
+    const SearchServer *server_ = nullptr;
+    uint64_t generation_ = 0;
+};
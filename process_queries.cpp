@@ -10,13 +10,7 @@
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer &search_server,
                                                   const std::vector<std::string> &queries)
 {
-
-    std::vector<std::vector<Document>> result(queries.size());
-
-    std::transform(std::execution::par, queries.begin(), queries.end(), result.begin(),
-                   [&search_server](const std::string &vec) { return search_server.FindTopDocuments(vec); });
-
-    return result;
+    return search_server.FindTopDocumentsBatch(queries);
 }
 
 std::vector<Document> ProcessQueriesJoined(const SearchServer &search_server,
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "document.h"
+
+using QueryDeadline = std::chrono::steady_clock::time_point;
+
+// Shared flag: copies of a token observe the same Cancel call
+class CancellationToken
+{
+public:
+    CancellationToken() : is_cancelled_(std::make_shared<std::atomic<bool>>(false))
+    {
+    }
+
+    void Cancel() const
+    {
+        is_cancelled_->store(true, std::memory_order_relaxed);
+    }
+
+    bool IsCancelled() const
+    {
+        return is_cancelled_->load(std::memory_order_relaxed);
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> is_cancelled_;
+};
+
+// Checked by the scoring loop between posting blocks; once it says stop, it keeps saying so
+class QueryControl
+{
+public:
+    QueryControl(QueryDeadline deadline, CancellationToken token) : deadline_(deadline), token_(std::move(token))
+    {
+    }
+
+    bool ShouldStop()
+    {
+        if (is_stopped_.load(std::memory_order_relaxed))
+        {
+            return true;
+        }
+        if (token_.IsCancelled() || std::chrono::steady_clock::now() >= deadline_)
+        {
+            is_stopped_.store(true, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    bool IsStopped() const
+    {
+        return is_stopped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    QueryDeadline deadline_;
+    CancellationToken token_;
+    std::atomic<bool> is_stopped_{false};
+};
+
+struct SearchResult
+{
+    std::vector<Document> documents;
+    // Scoring was cut short by the deadline or cancellation; documents are the best found so far
+    bool is_partial = false;
+};
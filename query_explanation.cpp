@@ -0,0 +1,35 @@
+#include "query_explanation.h"
+
+#include <iostream>
+
+using namespace std;
+
+ostream &operator<<(ostream &out, const QueryExplanation &explanation)
+{
+    for (const TermExplanation &term : explanation.terms)
+    {
+        out << (term.is_minus ? "-"s : term.is_required ? "+"s : ""s) << term.word << ": "s
+            << "postings = "s << term.posting_length << ", "s
+            << "weight = "s << term.weight << ", "s
+            << "scanned = "s << term.postings_scanned << ", "s
+            << "excluded = "s << term.documents_excluded << ", "s
+            << "rejected = "s << term.predicate_rejections << ", "s
+            << "time = "s << term.time.count() << " ns"s << endl;
+    }
+    if (explanation.candidates > 0)
+    {
+        out << "candidates = "s << explanation.candidates << ", "s
+            << "rejected = "s << explanation.candidate_rejections << endl;
+    }
+    if (explanation.phrase_rejections > 0)
+    {
+        out << "phrase rejections = "s << explanation.phrase_rejections << endl;
+    }
+    out << "matched = "s << explanation.matched_documents << ", "s
+        << "total time = "s << explanation.total_time.count() << " ns"s << endl;
+    for (const Document &document : explanation.documents)
+    {
+        out << document << endl;
+    }
+    return out;
+}
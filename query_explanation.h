@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "document.h"
+
+// Cost of one query word, as reported by SearchServer::ExplainQuery/ExplainMatch
+struct TermExplanation
+{
+    std::string word;
+    bool is_minus = false;
+    bool is_required = false;
+    // Documents holding the word (any of its expansions for word* and word~); zero if it is not in the index
+    size_t posting_length = 0;
+    // Term weight given by the ranking policy (IDF for TfIdfRanking)
+    double weight = 0.0;
+    // Postings read while scoring: the whole list, or one probe per candidate when the query has
+    // required words or phrases and the word's list is galloped
+    size_t postings_scanned = 0;
+    // Documents this word removed from the result: minus words, and required words a document lacks
+    size_t documents_excluded = 0;
+    // Postings of a plus word skipped because the document does not pass the filter
+    size_t predicate_rejections = 0;
+    // Time spent walking the word's list; zero when lists are galloped together, candidate by candidate
+    std::chrono::nanoseconds time{0};
+};
+
+struct QueryExplanation
+{
+    std::vector<TermExplanation> terms;
+    // Documents holding every required and phrase word, when the query has any; only they are scored
+    size_t candidates = 0;
+    // Candidates skipped because they do not pass the filter
+    size_t candidate_rejections = 0;
+    // Documents that hold the phrase words but not every phrase
+    size_t phrase_rejections = 0;
+    // Size of the whole matched set, before the top is cut off
+    size_t matched_documents = 0;
+    std::vector<Document> documents;
+    std::chrono::nanoseconds total_time{0};
+};
+
+std::ostream &operator<<(std::ostream &out, const QueryExplanation &explanation);
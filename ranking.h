@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+struct CorpusStats
+{
+    size_t document_count = 0;
+    double average_document_length = 0.0;
+};
+
+// A ranking policy is any type with
+//     double TermWeight(const CorpusStats &stats, size_t document_freq) const;
+//     double Score(const CorpusStats &stats, double term_weight, double term_freq, uint32_t document_length) const;
+// TermWeight is computed once per query term, Score once per posting. term_freq is the share of the
+// document's words taken by the term. Policies are passed by type, so Score is inlined into the scoring loop.
+
+struct TfIdfRanking
+{
+    double TermWeight(const CorpusStats &stats, size_t document_freq) const
+    {
+        return std::log(stats.document_count * 1.0 / document_freq);
+    }
+
+    double Score(const CorpusStats &, double term_weight, double term_freq, uint32_t) const
+    {
+        return term_freq * term_weight;
+    }
+};
+
+struct Bm25Ranking
+{
+    double k1 = 1.2;
+    double b = 0.75;
+
+    double TermWeight(const CorpusStats &stats, size_t document_freq) const
+    {
+        return std::log(1.0 + (stats.document_count - document_freq + 0.5) / (document_freq + 0.5));
+    }
+
+    double Score(const CorpusStats &stats, double term_weight, double term_freq, uint32_t document_length) const
+    {
+        const double count = term_freq * document_length;
+        const double length_norm =
+            stats.average_document_length > 0 ? document_length / stats.average_document_length : 1.0;
+        return term_weight * count * (k1 + 1) / (count + k1 * (1 - b + b * length_norm));
+    }
+};
@@ -1,6 +1,8 @@
 #include "request_queue.h"
 #include "document.h"
 
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <vector>
 
@@ -20,5 +22,63 @@ vector<Document> RequestQueue::AddFindRequest(const string &raw_query)
 
 int RequestQueue::GetNoResultRequests() const
 {
-  return count_of_empty_;
-}
\ No newline at end of file
+  return static_cast<int>(GetWindowStats().empty_results);
+}
+
+RequestQueue::WindowStats RequestQueue::GetWindowStats() const
+{
+  const int64_t now = GetCurrentSecond();
+  const int64_t oldest = now - static_cast<int64_t>(buckets_.size()) + 1;
+  WindowStats stats;
+  for (const Bucket &bucket : buckets_)
+  {
+    stats.requests += GetCount(bucket.requests, oldest, now);
+    stats.empty_results += GetCount(bucket.empty_results, oldest, now);
+    stats.errors += GetCount(bucket.errors, oldest, now);
+  }
+  return stats;
+}
+
+int64_t RequestQueue::GetCurrentSecond()
+{
+  return chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void RequestQueue::Count(atomic<uint64_t> &counter, uint32_t second)
+{
+  uint64_t current = counter.load(memory_order_relaxed);
+  while (true)
+  {
+    // A slow thread from the previous lap counts into the newer second instead of wiping it
+    const uint64_t next = static_cast<uint32_t>(current >> 32) < second ? (static_cast<uint64_t>(second) << 32) | 1
+                                                                        : current + 1;
+    if (counter.compare_exchange_weak(current, next, memory_order_relaxed))
+    {
+      return;
+    }
+  }
+}
+
+uint64_t RequestQueue::GetCount(const atomic<uint64_t> &counter, int64_t oldest, int64_t now)
+{
+  const uint64_t value = counter.load(memory_order_relaxed);
+  const int64_t second = static_cast<int64_t>(value >> 32);
+  return second < oldest || second > now ? 0 : value & 0xFFFFFFFFu;
+}
+
+void RequestQueue::Record(bool is_empty, bool is_error, Clock::duration latency)
+{
+  const int64_t now = GetCurrentSecond();
+  const uint32_t second = static_cast<uint32_t>(now);
+  Bucket &bucket = buckets_[static_cast<size_t>(now) % buckets_.size()];
+  Count(bucket.requests, second);
+  if (is_empty)
+  {
+    Count(bucket.empty_results, second);
+  }
+  if (is_error)
+  {
+    Count(bucket.errors, second);
+  }
+  latencies_.Record(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(latency).count()));
+}
@@ -1,33 +1,40 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <string>
 #include <vector>
-#include <deque>
 
 #include "document.h"
+#include "latency_histogram.h"
 #include "search_server.h"
 
+// Thread-safe front end collecting request statistics over a sliding wall-clock window.
+// The window is a fixed ring of per-second buckets; recording a request costs a few atomic operations.
 class RequestQueue {
 public:
-    explicit RequestQueue(const SearchServer& search_server) :
-        server_(search_server)
+    struct WindowStats {
+        uint64_t requests = 0;
+        uint64_t empty_results = 0;
+        uint64_t errors = 0;
+    };
+
+    explicit RequestQueue(const SearchServer& search_server, std::chrono::seconds window = std::chrono::hours(24)) :
+        server_(search_server), buckets_(static_cast<size_t>(window.count() > 0 ? window.count() : 1))
     {
     }
     template <typename DocumentPredicate>
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
-        std::vector<Document> tmp = server_.FindTopDocuments(raw_query, document_predicate);
-        const bool is_current_empty = tmp.empty();
-        if (is_current_empty) {
-            count_of_empty_++;
-        }
-
-        if (requests_.size() >= sec_in_day_) {
-            if (requests_.front().is_empty)
-                count_of_empty_--;
-            requests_.pop_front();
+        const auto start = Clock::now();
+        try {
+            std::vector<Document> tmp = server_.FindTopDocuments(raw_query, document_predicate);
+            Record(tmp.empty(), false, Clock::now() - start);
+            return tmp;
+        } catch (...) {
+            Record(false, true, Clock::now() - start);
+            throw;
         }
-        requests_.push_back({is_current_empty});
-        return tmp;
     }
 
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentStatus status);
@@ -36,14 +43,35 @@ public:
 
     int GetNoResultRequests() const;
 
+    WindowStats GetWindowStats() const;
+
+    // FindTopDocuments latencies since construction, successful and failed requests alike
+    const LatencyHistogram& GetLatencyHistogram() const {
+        return latencies_;
+    }
 
 private:
-    struct QueryResult {
-        bool is_empty;
+    using Clock = std::chrono::steady_clock;
+
+    // Every counter is one word: the wall-clock second it counts in the high 32 bits, the count in the
+    // low 32. The first increment of a new second swaps in (second, 1) with the same CAS that counts,
+    // so nobody waits for a reset and a counter never mixes two seconds.
+    struct Bucket {
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> empty_results{0};
+        std::atomic<uint64_t> errors{0};
     };
+
     const SearchServer& server_;
-    std::deque<QueryResult> requests_;
-    const static int sec_in_day_ = 1440;
-    int count_of_empty_ = 0;
+    std::vector<Bucket> buckets_;
+    LatencyHistogram latencies_;
+
+    static int64_t GetCurrentSecond();
+
+    static void Count(std::atomic<uint64_t>& counter, uint32_t second);
+
+    // Count of the counter if its second is within [oldest, now], zero otherwise
+    static uint64_t GetCount(const std::atomic<uint64_t>& counter, int64_t oldest, int64_t now);
 
+    void Record(bool is_empty, bool is_error, Clock::duration latency);
 };
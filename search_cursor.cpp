@@ -0,0 +1,111 @@
+#include "search_cursor.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+int ParseInt(string_view text)
+{
+    if (text.empty())
+    {
+        throw invalid_argument("Invalid search cursor"s);
+    }
+    size_t parsed = 0;
+    int value = 0;
+    try
+    {
+        value = stoi(string(text), &parsed);
+    }
+    catch (const exception &)
+    {
+        throw invalid_argument("Invalid search cursor"s);
+    }
+    if (parsed != text.size())
+    {
+        throw invalid_argument("Invalid search cursor"s);
+    }
+    return value;
+}
+} // namespace
+
+// <16 hex digits of the relevance bits>.<rating>.<id>, so the relevance survives the round trip exactly
+string EncodeCursor(const SearchCursor &cursor)
+{
+    uint64_t bits = 0;
+    memcpy(&bits, &cursor.relevance, sizeof(bits));
+    string token(16, '0');
+    for (int i = 15; i >= 0; --i)
+    {
+        token[i] = HEX_DIGITS[bits & 0xF];
+        bits >>= 4;
+    }
+    return token + "."s + to_string(cursor.rating) + "."s + to_string(cursor.id);
+}
+
+SearchCursor DecodeCursor(string_view token)
+{
+    const size_t first_dot = token.find('.');
+    const size_t second_dot = first_dot == string_view::npos ? first_dot : token.find('.', first_dot + 1);
+    if (first_dot != 16 || second_dot == string_view::npos)
+    {
+        throw invalid_argument("Invalid search cursor"s);
+    }
+
+    uint64_t bits = 0;
+    for (const char c : token.substr(0, 16))
+    {
+        const char *digit = strchr(HEX_DIGITS, c);
+        if (c == '\0' || digit == nullptr)
+        {
+            throw invalid_argument("Invalid search cursor"s);
+        }
+        bits = (bits << 4) | static_cast<uint64_t>(digit - HEX_DIGITS);
+    }
+
+    SearchCursor cursor;
+    memcpy(&cursor.relevance, &bits, sizeof(bits));
+    cursor.rating = ParseInt(token.substr(first_dot + 1, second_dot - first_dot - 1));
+    cursor.id = ParseInt(token.substr(second_dot + 1));
+    return cursor;
+}
+
+// Relevances are compared exactly: an epsilon makes the order non-transitive, and pages would then
+// skip or repeat documents
+bool ComesBefore(const Document &lhs, const Document &rhs)
+{
+    if (lhs.relevance != rhs.relevance)
+    {
+        return lhs.relevance > rhs.relevance;
+    }
+    if (lhs.rating != rhs.rating)
+    {
+        return lhs.rating > rhs.rating;
+    }
+    return lhs.id < rhs.id;
+}
+
+SearchPage SelectPage(vector<Document> documents, size_t page_size)
+{
+    SearchPage page;
+    const bool has_more = documents.size() > page_size;
+    const size_t count = min(page_size, documents.size());
+    partial_sort(documents.begin(), documents.begin() + count, documents.end(), ComesBefore);
+    documents.resize(count);
+    if (has_more && count > 0)
+    {
+        const Document &last = documents.back();
+        page.next_cursor = EncodeCursor({last.relevance, last.rating, last.id});
+    }
+    page.documents = move(documents);
+    return page;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+
+// Position in a result list: the last document of the previous page.
+// The server keeps no state, the next page is recomputed from the query and this position.
+struct SearchCursor
+{
+    double relevance = 0;
+    int rating = 0;
+    int id = 0;
+};
+
+struct SearchPage
+{
+    std::vector<Document> documents;
+    // Opaque token for the next page, empty when there are no more results
+    std::string next_cursor;
+};
+
+std::string EncodeCursor(const SearchCursor &cursor);
+
+// Throws std::invalid_argument if the token is malformed
+SearchCursor DecodeCursor(std::string_view token);
+
+// Total result order used for paging: relevance, then rating (both descending), then id
+bool ComesBefore(const Document &lhs, const Document &rhs);
+
+// Returns the first page_size of the documents in result order; they must all come after the cursor
+SearchPage SelectPage(std::vector<Document> documents, size_t page_size);
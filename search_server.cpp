@@ -2,9 +2,14 @@
 #include "document.h"
 #include "string_processing.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
 #include <execution>
+#include <limits>
 #include <map>
+#include <numeric>
 #include <set>
 #include <stdexcept>
 #include <string>
@@ -17,26 +22,97 @@ using namespace std;
 void SearchServer::AddDocument(int document_id, const string_view document, DocumentStatus status,
                                const vector<int> &ratings)
 {
+    TRACE_SCOPE(TraceStage::INDEXING);
     if (document_id < 0)
         throw invalid_argument("Document id must be positive"s);
-    if (documents_.count(document_id))
+    if (document_to_ordinal_.count(document_id))
         throw invalid_argument("Document id - "s + to_string(document_id) + " is already exists"s);
     const vector<string> words = SplitIntoWordsNoStop(string(document));
     const double inv_word_count = 1.0 / words.size();
+    const uint32_t ordinal =
+        attributes_.Add(document_id, ComputeAverageRating(ratings), status, static_cast<uint32_t>(words.size()));
+    map<size_t, vector<uint32_t>> term_positions;
+    uint32_t position = 0;
     for (const string &word : words)
     {
         auto [word_view, is_insert] = all_words_.emplace(word);
         string_view view_on_word(*word_view);
+        auto [term_it, is_new_term] = word_to_term_id_.emplace(view_on_word, term_to_document_freqs_.size());
+        if (is_new_term)
+        {
+            term_to_document_freqs_.emplace_back();
+            term_to_word_.push_back(view_on_word);
+            term_trie_.Insert(view_on_word, term_it->second);
+        }
         documents_to_word_freqs_[document_id][view_on_word] += inv_word_count;
-        word_to_document_freqs_[view_on_word][document_id] += inv_word_count;
+        // New documents always get the largest ordinal, so appending keeps postings sorted
+        PostingList &postings = term_to_document_freqs_[term_it->second];
+        if (postings.empty() || postings.back().ordinal != ordinal)
+        {
+            postings.push_back({ordinal, 0.0});
+        }
+        postings.back().term_freq += inv_word_count;
+        if (positions_)
+        {
+            term_positions[term_it->second].push_back(position);
+        }
+        ++position;
     }
-    documents_.emplace(document_id, DocumentData{ComputeAverageRating(ratings), status});
+    for (const auto &[term_id, positions] : term_positions)
+    {
+        positions_->Add(term_id, positions);
+    }
+    document_to_ordinal_.emplace(document_id, ordinal);
     doc_ids_.insert(document_id);
+    generation_ = NextGeneration();
+}
+
+void SearchServer::EnablePositionalIndex()
+{
+    if (!document_to_ordinal_.empty())
+    {
+        throw logic_error("Positional index must be enabled before documents are added"s);
+    }
+    positions_.emplace();
+}
+
+PreparedQuery SearchServer::PrepareQuery(const string_view raw_query) const
+{
+    const Query query = ParseQuery(raw_query);
+    PreparedQuery prepared;
+    prepared.plus_words_.assign(query.plus_words.begin(), query.plus_words.end());
+    prepared.minus_words_.assign(query.minus_words.begin(), query.minus_words.end());
+    prepared.required_words_.assign(query.required_words.begin(), query.required_words.end());
+    for (const QueryPhrase &phrase : query.phrases)
+    {
+        prepared.phrases_.push_back({{phrase.words.begin(), phrase.words.end()}, phrase.slop});
+    }
+    RefreshPreparedQuery(prepared);
+    return prepared;
+}
+
+void SearchServer::RefreshPreparedQuery(PreparedQuery &query) const
+{
+    // The plan points into the postings of the server that built it; a copy of that server shares the
+    // generation but not the postings, so the address is checked as well
+    if (query.server_ == this && query.generation_ == generation_)
+    {
+        return;
+    }
+    query.plan_ = BuildQueryPlan(query.plus_words_, query.minus_words_, query.required_words_, query.phrases_);
+    query.server_ = this;
+    query.generation_ = generation_;
+}
+
+uint64_t SearchServer::NextGeneration()
+{
+    static atomic<uint64_t> next_generation{1};
+    return next_generation.fetch_add(1, memory_order_relaxed);
 }
 
 size_t SearchServer::GetDocumentCount() const
 {
-    return documents_.size();
+    return document_to_ordinal_.size();
 }
 
 const map<string_view, double> &SearchServer::GetWordFrequencies(int document_id) const
@@ -53,14 +129,133 @@ const map<string_view, double> &SearchServer::GetWordFrequencies(int document_id
     }
 }
 
+MemoryUsage SearchServer::GetMemoryUsage() const
+{
+    MemoryUsage usage;
+
+    usage.dictionary = GetTreeBytes(all_words_) + GetTreeBytes(word_to_term_id_) + GetVectorBytes(term_to_word_) +
+                       term_trie_.GetMemoryUsage();
+    for (const string &word : all_words_)
+    {
+        usage.dictionary += GetStringBytes(word);
+    }
+
+    usage.inverted_index = GetVectorBytes(term_to_document_freqs_);
+    for (const PostingList &postings : term_to_document_freqs_)
+    {
+        usage.inverted_index += GetVectorBytes(postings);
+    }
+
+    if (positions_)
+    {
+        usage.positional_index = positions_->GetMemoryUsage();
+    }
+
+    usage.forward_index = GetTreeBytes(documents_to_word_freqs_);
+    for (const auto &[document_id, word_freqs] : documents_to_word_freqs_)
+    {
+        usage.forward_index += GetTreeBytes(word_freqs);
+    }
+
+    usage.document_metadata = attributes_.GetMemoryUsage() + GetTreeBytes(doc_ids_) +
+                              GetTreeBytes(document_to_ordinal_) + GetTreeBytes(stop_words_);
+    return usage;
+}
+
 const set<int> &SearchServer::GetAllDocumentsId() const
 {
     return doc_ids_;
 }
 
+void SearchServer::SetDocumentField(int document_id, const string_view field, double value)
+{
+    attributes_.SetNumericField(document_to_ordinal_.at(document_id), field, value);
+}
+
+void SearchServer::ReorderDocuments()
+{
+    TRACE_SCOPE(TraceStage::INDEXING);
+    using Signature = array<uint64_t, MINHASH_SIZE>;
+    struct Entry
+    {
+        Signature signature;
+        uint32_t ordinal;
+    };
+
+    vector<Entry> entries;
+    entries.reserve(document_to_ordinal_.size());
+    for (const auto &[document_id, ordinal] : document_to_ordinal_)
+    {
+        entries.push_back({{}, ordinal});
+    }
+    for_each(execution::par, entries.begin(), entries.end(), [&](Entry &entry) {
+        entry.signature.fill(numeric_limits<uint64_t>::max());
+        // Documents of stop words only have no forward index entry; they keep the all-max signature
+        const auto word_freqs = documents_to_word_freqs_.find(attributes_.GetId(entry.ordinal));
+        if (word_freqs == documents_to_word_freqs_.end())
+        {
+            return;
+        }
+        for (const auto &[word, freq] : word_freqs->second)
+        {
+            const uint64_t term_id = word_to_term_id_.at(word);
+            for (size_t i = 0; i < MINHASH_SIZE; ++i)
+            {
+                // splitmix64 finalizer with a different seed per hash function
+                uint64_t hash = term_id + 0x9E3779B97F4A7C15ull * (i + 1);
+                hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+                hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+                hash ^= hash >> 31;
+                entry.signature[i] = min(entry.signature[i], hash);
+            }
+        }
+    });
+    // Documents sharing their rarest-hashed terms end up together; ties keep the old order
+    sort(execution::par, entries.begin(), entries.end(), [](const Entry &lhs, const Entry &rhs) {
+        return tie(lhs.signature, lhs.ordinal) < tie(rhs.signature, rhs.ordinal);
+    });
+
+    vector<uint32_t> order;
+    order.reserve(entries.size());
+    vector<uint32_t> new_ordinals(attributes_.size());
+    for (const Entry &entry : entries)
+    {
+        new_ordinals[entry.ordinal] = static_cast<uint32_t>(order.size());
+        order.push_back(entry.ordinal);
+    }
+
+    attributes_.Reorder(order);
+    for (auto &[document_id, ordinal] : document_to_ordinal_)
+    {
+        ordinal = new_ordinals[ordinal];
+    }
+    // Removed documents are already gone from the postings, so every posting has a new ordinal
+    for_each(execution::par, term_to_document_freqs_.begin(), term_to_document_freqs_.end(),
+             [&](PostingList &postings) {
+                 vector<uint32_t> posting_order(postings.size());
+                 iota(posting_order.begin(), posting_order.end(), 0);
+                 sort(posting_order.begin(), posting_order.end(), [&](uint32_t lhs, uint32_t rhs) {
+                     return new_ordinals[postings[lhs].ordinal] < new_ordinals[postings[rhs].ordinal];
+                 });
+                 PostingList reordered;
+                 reordered.reserve(postings.size());
+                 for (const uint32_t index : posting_order)
+                 {
+                     reordered.push_back({new_ordinals[postings[index].ordinal], postings[index].term_freq});
+                 }
+                 postings = move(reordered);
+                 if (positions_)
+                 {
+                     positions_->Permute(&postings - term_to_document_freqs_.data(), posting_order);
+                 }
+             });
+    generation_ = NextGeneration();
+}
+
 SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word) const
 {
     bool is_minus = false;
+    bool is_required = false;
     if (word.empty())
     {
         throw invalid_argument("Word shouldn't be empty");
@@ -72,7 +267,93 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(string_view word) const
         is_minus = true;
         word = word.substr(1);
     }
-    return {word, is_minus, IsStopWord(word)};
+    else if (word[0] == '+')
+    {
+        is_required = true;
+        word = word.substr(1);
+        if (word.empty() || word[0] == '+' || word[0] == '-')
+        {
+            throw invalid_argument("The plus signs are entered incorrectly");
+        }
+    }
+    return {word, is_minus, is_required, IsStopWord(word)};
+}
+
+vector<string_view> SearchServer::ExtractPhrases(const vector<string_view> &words,
+                                                 vector<QueryPhrase> &phrases) const
+{
+    vector<string_view> rest;
+    rest.reserve(words.size());
+    bool in_phrase = false;
+    for (string_view word : words)
+    {
+        if (word.empty())
+        {
+            rest.push_back(word);
+            continue;
+        }
+        bool opens = false;
+        if (!in_phrase && word[0] == '"')
+        {
+            opens = true;
+            in_phrase = true;
+            phrases.emplace_back();
+            word.remove_prefix(1);
+        }
+        if (!in_phrase)
+        {
+            if (word.find('"') != string_view::npos)
+            {
+                throw invalid_argument("Phrase quote must start a word");
+            }
+            rest.push_back(word);
+            continue;
+        }
+
+        const size_t quote = word.find('"');
+        if (quote != string_view::npos)
+        {
+            const string_view tail = word.substr(quote + 1);
+            if (!tail.empty())
+            {
+                if (tail[0] != '~' || tail.size() == 1 ||
+                    !all_of(tail.begin() + 1, tail.end(), [](char c) { return c >= '0' && c <= '9'; }))
+                {
+                    throw invalid_argument("Phrase may only be followed by ~<distance>");
+                }
+                phrases.back().slop = static_cast<uint32_t>(stoul(string(tail.substr(1))));
+            }
+            word = word.substr(0, quote);
+            in_phrase = false;
+        }
+        if (!word.empty())
+        {
+            if (!IsValidWord(word))
+                throw invalid_argument("Text contains invalid characters");
+            if (word[0] == '-' || word[0] == '+')
+            {
+                throw invalid_argument("Phrase words can't be minus or required words");
+            }
+            if (!IsStopWord(word))
+            {
+                phrases.back().words.push_back(word);
+                rest.push_back(word);
+            }
+        }
+        else if (opens && in_phrase)
+        {
+            throw invalid_argument("Phrase must start right after the quote");
+        }
+        if (!in_phrase && phrases.back().words.empty())
+        {
+            throw invalid_argument("Phrase shouldn't be empty");
+        }
+    }
+    if (in_phrase)
+    {
+        throw invalid_argument("Phrase quote isn't closed");
+    }
+    return rest;
 }
 
 bool SearchServer::IsStopWord(const string_view word) const
@@ -127,7 +408,176 @@ int SearchServer::ComputeAverageRating(const vector<int> &ratings)
     return rating_sum / static_cast<int>(ratings.size());
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(const string_view word) const
+CorpusStats SearchServer::GetCorpusStats() const
+{
+    return {GetDocumentCount(), attributes_.GetAverageLength()};
+}
+
+vector<size_t> SearchServer::ExpandWord(const string_view word) const
+{
+    if (word.size() > 1 && word.back() == '*')
+    {
+        // A literal word* is in the dictionary under its own prefix, so it is found too
+        return term_trie_.FindByPrefix(word.substr(0, word.size() - 1));
+    }
+
+    const size_t tilde = word.rfind('~');
+    if (tilde != string_view::npos && tilde > 0)
+    {
+        const string_view distance = word.substr(tilde + 1);
+        if (distance.empty() || distance == "1"sv || distance == "2"sv)
+        {
+            const int max_distance = distance.empty() ? 1 : distance[0] - '0';
+            return term_trie_.FindWithinDistance(word.substr(0, tilde), max_distance);
+        }
+    }
+
+    auto it = word_to_term_id_.find(word);
+    if (it == word_to_term_id_.end())
+    {
+        return {};
+    }
+    return {it->second};
+}
+
+PostingList SearchServer::MergePostings(const vector<size_t> &term_ids) const
+{
+    PostingList all;
+    for (const size_t term_id : term_ids)
+    {
+        const PostingList &postings = term_to_document_freqs_[term_id];
+        all.insert(all.end(), postings.begin(), postings.end());
+    }
+    sort(all.begin(), all.end(), [](const Posting &lhs, const Posting &rhs) { return lhs.ordinal < rhs.ordinal; });
+
+    PostingList merged;
+    for (const Posting &posting : all)
+    {
+        if (!merged.empty() && merged.back().ordinal == posting.ordinal)
+        {
+            merged.back().term_freq += posting.term_freq;
+        }
+        else
+        {
+            merged.push_back(posting);
+        }
+    }
+    return merged;
+}
+
+bool SearchServer::MatchesPhraseAt(const PhrasePlan &phrase, uint32_t ordinal) const
+{
+    vector<vector<uint32_t>> positions;
+    positions.reserve(phrase.terms.size());
+    for (const TermPlan &term : phrase.terms)
+    {
+        // Phrase words are never expanded, so the term's own posting list addresses its positions
+        const PostingList &postings = term_to_document_freqs_[term.term_id];
+        const auto it = FindPosting(postings, ordinal);
+        if (it == postings.end())
+        {
+            return false;
+        }
+        positions.push_back(positions_->GetPositions(term.term_id, it - postings.begin()));
+    }
+    return MatchesPhrase(positions, phrase.slop);
+}
+
+bool SearchServer::MatchesPhrases(const Query &query, const QueryPlan &plan, uint32_t ordinal) const
+{
+    for (size_t i = 0; i < plan.phrases.size(); ++i)
+    {
+        // A phrase word missing from the index leaves the phrase with fewer terms than words
+        if (plan.phrases[i].terms.size() != query.phrases[i].words.size() || !MatchesPhraseAt(plan.phrases[i], ordinal))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+vector<uint32_t> SearchServer::MatchCandidates(const QueryPlan &plan, const ScoringHooks &hooks) const
 {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+    // Intersect every term that must be present, then check positions of the survivors only
+    vector<const PostingList *> postings;
+    for (const TermPlan &term : plan.required_terms)
+    {
+        postings.push_back(term.postings);
+    }
+    for (const PhrasePlan &phrase : plan.phrases)
+    {
+        for (const TermPlan &term : phrase.terms)
+        {
+            postings.push_back(term.postings);
+        }
+    }
+    vector<uint32_t> candidates = IntersectPostings(move(postings), hooks.control);
+    if (hooks.explanation != nullptr)
+    {
+        hooks.explanation->candidates = candidates.size();
+    }
+    if (plan.phrases.empty())
+    {
+        return candidates;
+    }
+
+    vector<uint32_t> result;
+    for (size_t index = 0; index < candidates.size(); ++index)
+    {
+        if (hooks.control != nullptr && index > 0 && index % POSTING_BLOCK_SIZE == 0 && hooks.control->ShouldStop())
+        {
+            break;
+        }
+        const uint32_t ordinal = candidates[index];
+        const bool phrases_match = all_of(plan.phrases.begin(), plan.phrases.end(),
+                                          [&](const PhrasePlan &phrase) { return MatchesPhraseAt(phrase, ordinal); });
+        if (phrases_match)
+        {
+            result.push_back(ordinal);
+        }
+    }
+    if (hooks.explanation != nullptr)
+    {
+        hooks.explanation->phrase_rejections = candidates.size() - result.size();
+    }
+    return result;
+}
+
+size_t SearchServer::EstimateFilterChecks(const QueryPlan &plan)
+{
+    size_t checks = numeric_limits<size_t>::max();
+    for (const TermPlan &term : plan.required_terms)
+    {
+        checks = min(checks, term.postings->size());
+    }
+    for (const PhrasePlan &phrase : plan.phrases)
+    {
+        for (const TermPlan &term : phrase.terms)
+        {
+            checks = min(checks, term.postings->size());
+        }
+    }
+    if (checks != numeric_limits<size_t>::max())
+    {
+        return checks;
+    }
+    checks = 0;
+    for (const TermPlan &term : plan.plus_terms)
+    {
+        checks += term.postings->size();
+    }
+    return checks;
+}
+
+bool SearchServer::CompareByRelevance(const Document &lhs, const Document &rhs)
+{
+    if (abs(lhs.relevance - rhs.relevance) >= 1e-6)
+    {
+        return lhs.relevance > rhs.relevance;
+    }
+    if (lhs.rating != rhs.rating)
+    {
+        return lhs.rating > rhs.rating;
+    }
+    return lhs.id < rhs.id;
 }
@@ -1,9 +1,11 @@
 #pragma once
 #include <algorithm>
+#include <chrono>
 #include <execution>
 #include <future>
 #include <map>
 #include <mutex>
+#include <optional>
 #include <set>
 #include <stdexcept>
 #include <string>
@@ -12,6 +14,16 @@
 
 #include "concurrent_containers.h"
 #include "document.h"
+#include "document_attributes.h"
+#include "memory_usage.h"
+#include "positional_index.h"
+#include "prepared_query.h"
+#include "query_control.h"
+#include "query_explanation.h"
+#include "ranking.h"
+#include "search_cursor.h"
+#include "term_trie.h"
+#include "trace.h"
 #include "string_processing.h"
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
@@ -43,35 +55,72 @@ public:
     void AddDocument(int document_id, const std::string_view document, DocumentStatus status,
                      const std::vector<int> &ratings);
 
+    // Starts storing word positions, which phrase queries ("word1 word2" or "word1 word2"~slop) need.
+    // Must be called before any document is added
+    void EnablePositionalIndex();
+
     // main
-    template <typename Execution, typename Key_mapper>
+    // Ranking is a policy type from ranking.h (TfIdfRanking by default, Bm25Ranking or a user one)
+    template <typename Execution, typename Key_mapper, typename Ranking = TfIdfRanking>
     std::vector<Document> FindTopDocuments(Execution &&exec_policy, const std::string_view raw_query,
-                                           Key_mapper key) const
+                                           Key_mapper key, const Ranking &ranking = Ranking{}) const
     {
+        const Query query = ParseQuery(exec_policy, raw_query);
+        return FindTopDocumentsByPlan(exec_policy, BuildQueryPlan(query), nullptr, key, ranking);
+    }
 
-        std::vector<Document> matched_documents;
-
+    // Declarative filters are evaluated over the attribute columns before scoring
+    template <typename Execution, typename Ranking = TfIdfRanking>
+    std::vector<Document> FindTopDocuments(Execution &&exec_policy, const std::string_view raw_query,
+                                           const DocumentFilter &filter, const Ranking &ranking = Ranking{}) const
+    {
         const Query query = ParseQuery(exec_policy, raw_query);
-        matched_documents = FindAllDocuments(exec_policy, query, key);
+        const QueryPlan plan = BuildQueryPlan(query);
+        const DocumentMask mask = attributes_.MakeMask(filter, EstimateFilterChecks(plan));
+        return FindTopDocumentsByPlan(exec_policy, plan, &mask, AcceptAll, ranking);
+    }
 
-        std::sort(exec_policy, matched_documents.begin(), matched_documents.end(),
-                  [](const Document &lhs, const Document &rhs) {
-                      if (std::abs(lhs.relevance - rhs.relevance) < 1e-6)
-                      {
-                          return lhs.rating > rhs.rating;
-                      }
-                      else
-                      {
-                          return lhs.relevance > rhs.relevance;
-                      }
-                  });
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query, const DocumentFilter &filter) const
+    {
+        return FindTopDocuments(std::execution::seq, raw_query, filter);
+    }
 
-        if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT)
-        {
-            matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
-        }
-        return matched_documents;
+    // Executes a query prepared by PrepareQuery, re-resolving it first if the index has changed since
+    template <typename Execution, typename Key_mapper, typename Ranking = TfIdfRanking>
+    std::vector<Document> FindTopDocuments(Execution &&exec_policy, PreparedQuery &query, Key_mapper key,
+                                           const Ranking &ranking = Ranking{}) const
+    {
+        RefreshPreparedQuery(query);
+        return FindTopDocumentsByPlan(exec_policy, query.plan_, nullptr, key, ranking);
+    }
+
+    template <typename Execution, typename Ranking = TfIdfRanking>
+    std::vector<Document> FindTopDocuments(Execution &&exec_policy, PreparedQuery &query,
+                                           const DocumentFilter &filter, const Ranking &ranking = Ranking{}) const
+    {
+        RefreshPreparedQuery(query);
+        const DocumentMask mask = attributes_.MakeMask(filter, EstimateFilterChecks(query.plan_));
+        return FindTopDocumentsByPlan(exec_policy, query.plan_, &mask, AcceptAll, ranking);
+    }
+
+    std::vector<Document> FindTopDocuments(PreparedQuery &query, const DocumentFilter &filter) const
+    {
+        return FindTopDocuments(std::execution::seq, query, filter);
+    }
+
+    template <typename Key_mapper>
+    std::vector<Document> FindTopDocuments(PreparedQuery &query, Key_mapper key) const
+    {
+        return FindTopDocuments(std::execution::seq, query, key);
+    }
+
+    std::vector<Document> FindTopDocuments(PreparedQuery &query, DocumentStatus raw_status = DocumentStatus::ACTUAL) const
+    {
+        return FindTopDocuments(std::execution::seq, query, MakeStatusFilter(raw_status));
     }
+
+    PreparedQuery PrepareQuery(const std::string_view raw_query) const;
+
     template <typename Key_mapper>
     std::vector<Document> FindTopDocuments(const std::string_view raw_query, Key_mapper key) const
     {
@@ -89,22 +138,315 @@ public:
         return FindTopDocuments(std::execution::seq, raw_query, DocumentStatus::ACTUAL);
     }
 
-    template <typename Execution>
+    template <typename Execution, typename Ranking = TfIdfRanking>
     std::vector<Document> FindTopDocuments(Execution &&exec_policy, const std::string_view raw_query,
-                                           DocumentStatus raw_status) const
+                                           DocumentStatus raw_status, const Ranking &ranking = Ranking{}) const
     {
-        return FindTopDocuments(exec_policy, raw_query,
-                                [raw_status](int document_id, DocumentStatus status, int rating) {
-                                    return status == raw_status;
-                                });
+        return FindTopDocuments(exec_policy, raw_query, MakeStatusFilter(raw_status), ranking);
     }
 
     std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentStatus raw_status) const
     {
-        return FindTopDocuments(std::execution::seq, raw_query,
-                                [raw_status](int document_id, DocumentStatus status, int rating) {
-                                    return status == raw_status;
-                                });
+        return FindTopDocuments(std::execution::seq, raw_query, MakeStatusFilter(raw_status));
+    }
+
+    // Search-after paging: pass an empty cursor for the first page, then the next_cursor of the previous one.
+    // Only the documents after the cursor are ranked, and only page_size of them are sorted
+    template <typename Execution, typename Key_mapper, typename Ranking = TfIdfRanking>
+    SearchPage FindPage(Execution &&exec_policy, const std::string_view raw_query, Key_mapper key,
+                        const std::string_view cursor, size_t page_size, const Ranking &ranking = Ranking{}) const
+    {
+        const Query query = ParseQuery(exec_policy, raw_query);
+        return FindPageByPlan(BuildQueryPlan(query), nullptr, key, cursor, page_size, ranking);
+    }
+
+    template <typename Execution, typename Ranking = TfIdfRanking>
+    SearchPage FindPage(Execution &&exec_policy, const std::string_view raw_query, const DocumentFilter &filter,
+                        const std::string_view cursor, size_t page_size, const Ranking &ranking = Ranking{}) const
+    {
+        const Query query = ParseQuery(exec_policy, raw_query);
+        const QueryPlan plan = BuildQueryPlan(query);
+        const DocumentMask mask = attributes_.MakeMask(filter, EstimateFilterChecks(plan));
+        return FindPageByPlan(plan, &mask, AcceptAll, cursor, page_size, ranking);
+    }
+
+    SearchPage FindPage(const std::string_view raw_query, const std::string_view cursor, size_t page_size,
+                        DocumentStatus status = DocumentStatus::ACTUAL) const
+    {
+        return FindPage(std::execution::seq, raw_query, MakeStatusFilter(status), cursor, page_size);
+    }
+
+    // Scoring stops at the next posting block once the deadline passes or the token is cancelled;
+    // the first block is always scored, and the best documents found by then are returned with is_partial set
+    template <typename Ranking = TfIdfRanking>
+    SearchResult FindTopDocumentsLimited(const std::string_view raw_query, const DocumentFilter &filter,
+                                         QueryDeadline deadline, const CancellationToken &token = {},
+                                         const Ranking &ranking = Ranking{}) const
+    {
+        QueryControl control(deadline, token);
+        const Query query = ParseQuery(raw_query);
+        const QueryPlan plan = BuildQueryPlan(query);
+        const DocumentMask mask = attributes_.MakeMask(filter, EstimateFilterChecks(plan));
+        SearchResult result;
+        ScoringHooks hooks;
+        hooks.control = &control;
+        result.documents = FindTopDocumentsByPlan(std::execution::seq, plan, &mask, AcceptAll, ranking, hooks);
+        result.is_partial = control.IsStopped();
+        return result;
+    }
+
+    // Runs FindTopDocumentsLimited on another thread. The server must outlive the future
+    // and must not be modified until the future is ready
+    template <typename Ranking = TfIdfRanking>
+    std::future<SearchResult> FindTopDocumentsAsync(std::string raw_query, DocumentFilter filter,
+                                                    QueryDeadline deadline, CancellationToken token = {},
+                                                    Ranking ranking = Ranking{}) const
+    {
+        return std::async(std::launch::async, [this, raw_query = std::move(raw_query), filter = std::move(filter),
+                                               deadline, token = std::move(token), ranking] {
+            return FindTopDocumentsLimited(raw_query, filter, deadline, token, ranking);
+        });
+    }
+
+    std::future<SearchResult> FindTopDocumentsAsync(std::string raw_query, DocumentStatus status,
+                                                    QueryDeadline deadline, CancellationToken token = {}) const
+    {
+        return FindTopDocumentsAsync(std::move(raw_query), MakeStatusFilter(status), deadline, std::move(token));
+    }
+
+    // Batch form of FindTopDocuments(query, filter) with identical results, in the order of raw_queries.
+    // Queries are taken in chunks and each posting list a chunk needs is walked once, scoring every
+    // posting for all queries of the chunk that contain the term
+    template <typename Ranking = TfIdfRanking>
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string> &raw_queries,
+                                                             const DocumentFilter &filter,
+                                                             const Ranking &ranking = Ranking{}) const
+    {
+        // Parsing throws on malformed queries, which must not escape a parallel algorithm
+        std::vector<Query> queries;
+        queries.reserve(raw_queries.size());
+        for (const std::string &raw_query : raw_queries)
+        {
+            queries.push_back(ParseQuery(raw_query));
+        }
+        std::vector<QueryPlan> plans(queries.size());
+        std::transform(std::execution::par, queries.begin(), queries.end(), plans.begin(),
+                       [this](const Query &query) { return BuildQueryPlan(query); });
+        size_t filter_checks = 0;
+        for (const QueryPlan &plan : plans)
+        {
+            filter_checks += EstimateFilterChecks(plan);
+        }
+        const DocumentMask mask = attributes_.MakeMask(filter, filter_checks);
+
+        std::vector<std::vector<Document>> results(plans.size());
+        std::vector<size_t> shared_queries;
+        for (size_t i = 0; i < plans.size(); ++i)
+        {
+            const QueryPlan &plan = plans[i];
+            // Required terms and phrases already narrow the query to a small candidate set
+            if (plan.phrases.empty() && plan.required_terms.empty() && !plan.has_missing_required_term)
+            {
+                shared_queries.push_back(i);
+            }
+            else
+            {
+                results[i] = FindTopDocumentsByPlan(std::execution::seq, plan, &mask, AcceptAll, ranking);
+            }
+        }
+
+        std::vector<size_t> chunk_starts;
+        for (size_t start = 0; start < shared_queries.size(); start += BATCH_CHUNK_SIZE)
+        {
+            chunk_starts.push_back(start);
+        }
+        std::for_each(std::execution::par, chunk_starts.begin(), chunk_starts.end(), [&](size_t start) {
+            const size_t end = std::min(shared_queries.size(), start + BATCH_CHUNK_SIZE);
+            FindTopDocumentsShared(plans, shared_queries.data() + start, end - start, mask, ranking, results);
+        });
+        return results;
+    }
+
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string> &raw_queries,
+                                                             DocumentStatus status = DocumentStatus::ACTUAL) const
+    {
+        return FindTopDocumentsBatch(raw_queries, MakeStatusFilter(status));
+    }
+
+    // Top documents plus facet counts from one scoring pass. The facets count every live document the
+    // query matches, whatever the filter, so a status facet next to an ACTUAL-only top shows how many
+    // results each other status would give; the filter only selects the documents the top is taken from
+    template <typename Ranking = TfIdfRanking>
+    FacetedResult FindTopDocumentsWithFacets(const std::string_view raw_query, const DocumentFilter &filter,
+                                             const std::vector<FacetDefinition> &facets,
+                                             const Ranking &ranking = Ranking{}) const
+    {
+        const Query query = ParseQuery(raw_query);
+        const QueryPlan plan = BuildQueryPlan(query);
+        const DocumentMask alive = attributes_.MakeMask(DocumentFilter{}, EstimateFilterChecks(plan));
+        std::vector<uint32_t> ordinals;
+        std::vector<Document> matched_documents =
+            FindAllDocuments(std::execution::seq, plan, &alive, AcceptAll, ranking, ScoringHooks{nullptr, &ordinals});
+        const DocumentMask mask = attributes_.MakeMask(filter, ordinals.size());
+
+        FacetedResult result;
+        for (const FacetDefinition &facet : facets)
+        {
+            result.facet_counts.push_back(attributes_.CountFacet(ordinals, facet));
+        }
+
+        TRACE_SCOPE(TraceStage::TOP_K);
+        for (size_t i = 0; i < matched_documents.size(); ++i)
+        {
+            if (mask.Accepts(ordinals[i]))
+            {
+                result.documents.push_back(matched_documents[i]);
+            }
+        }
+        result.matched_documents = result.documents.size();
+        const size_t result_count = std::min<size_t>(result.documents.size(), MAX_RESULT_DOCUMENT_COUNT);
+        std::partial_sort(result.documents.begin(), result.documents.begin() + result_count, result.documents.end(),
+                          CompareByRelevance);
+        result.documents.resize(result_count);
+        return result;
+    }
+
+    FacetedResult FindTopDocumentsWithFacets(const std::string_view raw_query, DocumentStatus status,
+                                             const std::vector<FacetDefinition> &facets) const
+    {
+        return FindTopDocumentsWithFacets(raw_query, MakeStatusFilter(status), facets);
+    }
+
+    // Runs the query like FindTopDocuments(raw_query, filter, ranking) and reports the cost of every word.
+    // The query goes through the same scoring loops, sequentially, with counters attached; words missing
+    // from the index are listed last
+    template <typename Ranking = TfIdfRanking>
+    QueryExplanation ExplainQuery(const std::string_view raw_query, const DocumentFilter &filter,
+                                  const Ranking &ranking = Ranking{}) const
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const Query query = ParseQuery(raw_query);
+        std::vector<std::string_view> term_words;
+        const QueryPlan plan = BuildQueryPlan(query, &term_words);
+        const DocumentMask mask = attributes_.MakeMask(filter, EstimateFilterChecks(plan));
+        const CorpusStats stats = GetCorpusStats();
+
+        QueryExplanation explanation;
+        for (size_t i = 0; i < term_words.size(); ++i)
+        {
+            const bool is_minus = i >= plan.plus_terms.size();
+            const TermPlan &term_plan = is_minus ? plan.minus_terms[i - plan.plus_terms.size()] : plan.plus_terms[i];
+            TermExplanation term;
+            term.word = std::string(term_words[i]);
+            term.is_minus = is_minus;
+            term.is_required = !is_minus && query.required_words.count(term_words[i]) > 0;
+            term.posting_length = term_plan.postings->size();
+            term.weight = ranking.TermWeight(stats, term.posting_length);
+            explanation.terms.push_back(std::move(term));
+        }
+
+        ScoringHooks hooks;
+        hooks.explanation = &explanation;
+        explanation.documents = FindAllDocuments(std::execution::seq, plan, &mask, AcceptAll, ranking, hooks);
+
+        for (const bool is_minus : {false, true})
+        {
+            for (const std::string_view word : is_minus ? query.minus_words : query.plus_words)
+            {
+                if (std::find(term_words.begin(), term_words.end(), word) == term_words.end())
+                {
+                    TermExplanation term;
+                    term.word = std::string(word);
+                    term.is_minus = is_minus;
+                    term.is_required = query.required_words.count(word) > 0;
+                    explanation.terms.push_back(std::move(term));
+                }
+            }
+        }
+
+        explanation.matched_documents = explanation.documents.size();
+        const size_t result_count = std::min<size_t>(explanation.documents.size(), MAX_RESULT_DOCUMENT_COUNT);
+        std::partial_sort(explanation.documents.begin(), explanation.documents.begin() + result_count,
+                          explanation.documents.end(), CompareByRelevance);
+        explanation.documents.resize(result_count);
+        explanation.total_time = std::chrono::steady_clock::now() - start;
+        return explanation;
+    }
+
+    QueryExplanation ExplainQuery(const std::string_view raw_query,
+                                  DocumentStatus status = DocumentStatus::ACTUAL) const
+    {
+        return ExplainQuery(raw_query, MakeStatusFilter(status));
+    }
+
+    // Per-word breakdown of MatchDocument. postings_scanned counts the posting lists probed for the
+    // document, documents_excluded is 1 for a minus word it contains or a required word it lacks,
+    // and matched_documents is 1 if MatchDocument would return any words. Term weights come from ranking
+    template <typename Ranking = TfIdfRanking>
+    QueryExplanation ExplainMatch(const std::string_view raw_query, int document_id,
+                                  const Ranking &ranking = Ranking{}) const
+    {
+        using Clock = std::chrono::steady_clock;
+        const auto start = Clock::now();
+        const Query query = ParseQuery(raw_query);
+        const QueryPlan plan = BuildQueryPlan(query);
+        const uint32_t ordinal = document_to_ordinal_.at(document_id);
+        const CorpusStats stats = GetCorpusStats();
+
+        QueryExplanation explanation;
+        bool has_plus_word = false;
+        bool is_excluded = false;
+        auto explain_word = [&](std::string_view word, bool is_minus) {
+            const auto term_start = Clock::now();
+            TermExplanation term;
+            term.word = std::string(word);
+            term.is_minus = is_minus;
+            term.is_required = query.required_words.count(word) > 0;
+            bool is_present = false;
+            const std::vector<size_t> term_ids = ExpandWord(word);
+            for (const size_t term_id : term_ids)
+            {
+                ++term.postings_scanned;
+                is_present = is_present || ContainsOrdinal(term_to_document_freqs_[term_id], ordinal);
+            }
+            // Expansions of a word share documents, so the weight comes from the size of their union
+            term.posting_length = term_ids.size() == 1 ? term_to_document_freqs_[term_ids[0]].size()
+                                                       : MergePostings(term_ids).size();
+            if (term.posting_length > 0)
+            {
+                term.weight = ranking.TermWeight(stats, term.posting_length);
+            }
+            if (is_minus ? is_present : term.is_required && !is_present)
+            {
+                term.documents_excluded = 1;
+                is_excluded = true;
+            }
+            has_plus_word = has_plus_word || (!is_minus && is_present);
+            term.time = Clock::now() - term_start;
+            explanation.terms.push_back(std::move(term));
+        };
+        for (const std::string_view word : query.plus_words)
+        {
+            explain_word(word, false);
+        }
+        for (const std::string_view word : query.minus_words)
+        {
+            explain_word(word, true);
+        }
+
+        if (has_plus_word && !is_excluded)
+        {
+            if (MatchesPhrases(query, plan, ordinal))
+            {
+                explanation.matched_documents = 1;
+            }
+            else
+            {
+                explanation.phrase_rejections = 1;
+            }
+        }
+        explanation.total_time = Clock::now() - start;
+        return explanation;
     }
 
     size_t GetDocumentCount() const;
@@ -121,34 +463,62 @@ public:
     {
 
         const Query query = ParseQuery(exec_policy, raw_query);
+        const uint32_t ordinal = document_to_ordinal_.at(document_id);
         std::vector<std::string_view> matched_words;
         matched_words.reserve(query.plus_words.size());
         std::mutex mut;
         for_each(exec_policy, query.plus_words.begin(), query.plus_words.end(), [&](std::string_view word) {
-            if (word_to_document_freqs_.count(word) != 0)
+            for (const size_t term_id : ExpandWord(word))
             {
-                if (word_to_document_freqs_.at(word).count(document_id))
+                if (ContainsOrdinal(term_to_document_freqs_[term_id], ordinal))
                 {
                     std::lock_guard<std::mutex> g(mut);
-                    matched_words.push_back(word);
+                    matched_words.push_back(term_to_word_[term_id]);
                 }
             }
         });
 
         for (std::string_view word : query.minus_words)
         {
-            if (word_to_document_freqs_.count(word) == 0)
+            const std::vector<size_t> term_ids = ExpandWord(word);
+            const bool is_excluded = std::any_of(term_ids.begin(), term_ids.end(), [&](size_t term_id) {
+                return ContainsOrdinal(term_to_document_freqs_[term_id], ordinal);
+            });
+            if (is_excluded)
             {
-                continue;
+                matched_words.clear();
+                break;
             }
-            if (word_to_document_freqs_.at(word).count(document_id))
+        }
+
+        for (std::string_view word : query.required_words)
+        {
+            const std::vector<size_t> term_ids = ExpandWord(word);
+            const bool is_present = std::any_of(term_ids.begin(), term_ids.end(), [&](size_t term_id) {
+                return ContainsOrdinal(term_to_document_freqs_[term_id], ordinal);
+            });
+            if (!is_present)
             {
                 matched_words.clear();
                 break;
             }
         }
 
-        return {matched_words, documents_.at(document_id).status};
+        if (!query.phrases.empty())
+        {
+            const QueryPlan plan = BuildQueryPlan(query);
+            const bool phrases_match =
+                !plan.has_missing_required_term && std::all_of(plan.phrases.begin(), plan.phrases.end(),
+                                                               [&](const PhrasePlan &phrase) {
+                                                                   return MatchesPhraseAt(phrase, ordinal);
+                                                               });
+            if (!phrases_match)
+            {
+                matched_words.clear();
+            }
+        }
+
+        return {matched_words, attributes_.GetStatus(ordinal)};
     }
 
     const auto begin() const
@@ -163,6 +533,8 @@ public:
 
     const std::map<std::string_view, double> &GetWordFrequencies(int document_id) const;
 
+    MemoryUsage GetMemoryUsage() const;
+
     void RemoveDocument(int document_id)
     {
         return RemoveDocument(std::execution::seq, document_id);
@@ -171,41 +543,150 @@ public:
     template <typename ExecutionPolicy>
     void RemoveDocument(ExecutionPolicy exec_policy, int document_id)
     {
+        TRACE_SCOPE(TraceStage::INDEXING);
         auto iter = doc_ids_.find(document_id);
         if (iter == doc_ids_.end())
             throw std::invalid_argument("Document id doesn't exist");
         doc_ids_.erase(iter);
-        documents_.erase(document_id);
+        const uint32_t ordinal = document_to_ordinal_.at(document_id);
+        document_to_ordinal_.erase(document_id);
+        attributes_.Remove(ordinal);
 
         std::for_each(exec_policy, documents_to_word_freqs_.at(document_id).begin(),
                       documents_to_word_freqs_.at(document_id).end(), [&](auto &word_to_freqs) {
-                          word_to_document_freqs_.at(word_to_freqs.first).erase(document_id);
+                          const size_t term_id = word_to_term_id_.at(word_to_freqs.first);
+                          PostingList &postings = term_to_document_freqs_[term_id];
+                          const auto it = FindPosting(postings, ordinal);
+                          if (it == postings.end())
+                          {
+                              return;
+                          }
+                          if (positions_)
+                          {
+                              positions_->Remove(term_id, it - postings.begin());
+                          }
+                          postings.erase(it);
                       });
 
         documents_to_word_freqs_.erase(document_id);
+        generation_ = NextGeneration();
     }
 
     const std::set<int> &GetAllDocumentsId() const;
 
+    // User-defined numeric attribute, usable in DocumentFilter::numeric_ranges
+    void SetDocumentField(int document_id, const std::string_view field, double value);
+
+    // Renumbers the internal ordinals so that documents with similar vocabulary sit next to each other,
+    // which shortens the gaps in posting lists and lets intersections skip longer runs. Also drops the
+    // ordinals of removed documents. External ids and results do not change; prepared queries re-resolve.
+    // Documents are ordered by MinHash signatures of their term sets
+    void ReorderDocuments();
+
 private:
     std::set<int> doc_ids_;
     std::set<std::string> stop_words_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
+    std::map<std::string_view, size_t> word_to_term_id_;
+    std::vector<PostingList> term_to_document_freqs_;
+    std::vector<std::string_view> term_to_word_;
+    TermTrie term_trie_;
     std::map<int, std::map<std::string_view, double>> documents_to_word_freqs_;
     std::set<std::string, std::less<>> all_words_;
-    std::map<int, DocumentData> documents_;
+    std::map<int, uint32_t> document_to_ordinal_;
+    DocumentAttributes attributes_;
+    std::optional<PositionalIndex> positions_;
+    // Replaced by every index mutation so prepared queries know when to re-resolve. Generations come
+    // from one process-wide counter, so no two servers ever share one unless one is a copy of the other
+    uint64_t generation_ = NextGeneration();
 
     struct QueryWord
     {
         std::string_view data;
         bool is_minus;
+        bool is_required;
         bool is_stop;
     };
 
+    struct QueryPhrase
+    {
+        std::vector<std::string_view> words;
+        uint32_t slop = 0;
+    };
+
+    // Optional limits and outputs of one scoring pass; every member may be null
+    struct ScoringHooks
+    {
+        // Stops scoring early, at the next posting block
+        QueryControl *control = nullptr;
+        // Receives the ordinal of every returned document, in the same order
+        std::vector<uint32_t> *ordinals = nullptr;
+        // Paging cursor: only documents that come after it in ComesBefore order are returned
+        const Document *after = nullptr;
+        // If non-zero, only the first limit documents in ComesBefore order are kept, unsorted, in a heap
+        // bounded by this size. Not combined with ordinals
+        size_t limit = 0;
+        // Per-term counters, for ExplainQuery. terms must hold an entry for every plus term and then
+        // every minus term of the plan, in plan order. Only valid with a sequential policy
+        QueryExplanation *explanation = nullptr;
+    };
+
+    // Counts and times one term of a scoring pass into hooks.explanation; does nothing without one
+    class ScopedTermStats
+    {
+    public:
+        ScopedTermStats(const ScoringHooks &hooks, size_t term_index)
+            : term_(hooks.explanation != nullptr ? &hooks.explanation->terms[term_index] : nullptr)
+        {
+            if (term_ != nullptr)
+            {
+                start_ = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~ScopedTermStats()
+        {
+            if (term_ != nullptr)
+            {
+                term_->time += std::chrono::steady_clock::now() - start_;
+            }
+        }
+
+        void ScanPostings(size_t count)
+        {
+            if (term_ != nullptr)
+            {
+                term_->postings_scanned += count;
+            }
+        }
+
+        void RejectPosting()
+        {
+            if (term_ != nullptr)
+            {
+                ++term_->predicate_rejections;
+            }
+        }
+
+        void ExcludeDocuments(size_t count)
+        {
+            if (term_ != nullptr)
+            {
+                term_->documents_excluded += count;
+            }
+        }
+
+    private:
+        TermExplanation *term_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // Required (+word) words are also kept among the plus words, since they are scored the same way
     struct Query
     {
         std::set<std::string_view> plus_words;
         std::set<std::string_view> minus_words;
+        std::set<std::string_view> required_words;
+        std::vector<QueryPhrase> phrases;
     };
 
     QueryWord ParseQueryWord(std::string_view word) const;
@@ -218,15 +699,18 @@ private:
     template <typename ExecutionPolicy>
     Query ParseQuery(ExecutionPolicy &&exec_policy, const std::string_view text) const
     {
+        TRACE_SCOPE(TraceStage::PARSE);
         if (!IsCorrectString(text))
             throw std::invalid_argument("The minus signs are entered incorrectly");
 
-        auto words = SplitIntoWordsView(text);
+        std::vector<QueryPhrase> phrases;
+        auto words = ExtractPhrases(SplitIntoWordsView(text), phrases);
 
         if constexpr (std::is_same_v<ExecutionPolicy, std::execution::parallel_policy>)
         {
             ConcurrentSet<std::string_view> plus_words(16);
             ConcurrentSet<std::string_view> minus_words(16);
+            ConcurrentSet<std::string_view> required_words(16);
 
             std::for_each(exec_policy, words.begin(), words.end(), [&](std::string_view str) {
                 const QueryWord query_word = ParseQueryWord(str);
@@ -241,6 +725,10 @@ private:
                     {
 
                         plus_words.insert(query_word.data);
+                        if (query_word.is_required)
+                        {
+                            required_words.insert(query_word.data);
+                        }
                     }
                 }
             });
@@ -248,6 +736,8 @@ private:
 
             result.minus_words = minus_words.BuildOrdinaryset();
             result.plus_words = plus_words.BuildOrdinaryset();
+            result.required_words = required_words.BuildOrdinaryset();
+            result.phrases = std::move(phrases);
 
             return result;
         }
@@ -266,13 +756,22 @@ private:
                     else
                     {
                         query.plus_words.insert(query_word.data);
+                        if (query_word.is_required)
+                        {
+                            query.required_words.insert(query_word.data);
+                        }
                     }
                 }
             });
+            query.phrases = std::move(phrases);
             return query;
         }
     }
 
+    // Moves quoted phrases out of the token list; phrase words stay in the result as ordinary plus words
+    std::vector<std::string_view> ExtractPhrases(const std::vector<std::string_view> &words,
+                                                 std::vector<QueryPhrase> &phrases) const;
+
     bool IsStopWord(const std::string_view word) const;
 
     static bool IsCorrectString(const std::string_view str);
@@ -283,54 +782,518 @@ private:
 
     static int ComputeAverageRating(const std::vector<int> &ratings);
 
-    double ComputeWordInverseDocumentFreq(const std::string_view word) const;
+    // Term ids a query word stands for: the word itself, every term starting with it (word*)
+    // or every term within N edits of it (word~N, N is 1 or 2, word~ means word~1).
+    // Any other '~' or '*' is part of the word, so a~b or 1~3 is looked up as is
+    std::vector<size_t> ExpandWord(const std::string_view word) const;
 
-    template <typename ExecutionPolicy, typename Key_mapper>
-    std::vector<Document> FindAllDocuments(ExecutionPolicy &&exec_policy, const Query &query,
-                                           Key_mapper key) const
+    // Expanded words are resolved only when expand is set; phrases match words literally.
+    // resolved_words (may be null) receives the query word of every returned term
+    template <typename WordContainer>
+    std::vector<TermPlan> ResolveTerms(const WordContainer &words, bool expand = true,
+                                       std::vector<std::string_view> *resolved_words = nullptr) const
     {
+        std::vector<TermPlan> terms;
+        terms.reserve(words.size());
+        for (const std::string_view word : words)
+        {
+            if (!expand)
+            {
+                auto it = word_to_term_id_.find(word);
+                if (it != word_to_term_id_.end() && !term_to_document_freqs_[it->second].empty())
+                {
+                    terms.push_back({it->second, &term_to_document_freqs_[it->second], nullptr});
+                    if (resolved_words != nullptr)
+                    {
+                        resolved_words->push_back(word);
+                    }
+                }
+                continue;
+            }
 
-        ConcurrentMap<int, double> document_to_relevance(16);
+            std::vector<size_t> term_ids = ExpandWord(word);
+            term_ids.erase(std::remove_if(term_ids.begin(), term_ids.end(),
+                                          [&](size_t term_id) { return term_to_document_freqs_[term_id].empty(); }),
+                           term_ids.end());
+            if (term_ids.size() == 1)
+            {
+                terms.push_back({term_ids[0], &term_to_document_freqs_[term_ids[0]], nullptr});
+            }
+            else if (term_ids.size() > 1)
+            {
+                auto postings = std::make_shared<const PostingList>(MergePostings(term_ids));
+                terms.push_back({EXPANDED_TERM_ID, postings.get(), postings});
+            }
+            if (resolved_words != nullptr && !term_ids.empty())
+            {
+                resolved_words->push_back(word);
+            }
+        }
+        return terms;
+    }
 
-        std::for_each(
-            exec_policy, query.plus_words.begin(), query.plus_words.end(), [&](const std::string_view word) {
-                if (word_to_document_freqs_.count(word) != 0)
-                {
+    // Union of the terms' postings; a document matching several terms gets the sum of their frequencies
+    PostingList MergePostings(const std::vector<size_t> &term_ids) const;
+
+    // term_words (may be null) receives the query word of every plus term and then every minus term
+    template <typename WordContainer, typename PhraseContainer>
+    QueryPlan BuildQueryPlan(const WordContainer &plus_words, const WordContainer &minus_words,
+                             const WordContainer &required_words, const PhraseContainer &phrases,
+                             std::vector<std::string_view> *term_words = nullptr) const
+    {
+        TRACE_SCOPE(TraceStage::RESOLVE);
+        QueryPlan plan{ResolveTerms(plus_words, true, term_words), ResolveTerms(minus_words, true, term_words),
+                       ResolveTerms(required_words), {}, false};
+        if (plan.required_terms.size() != required_words.size())
+        {
+            plan.has_missing_required_term = true;
+        }
+        if (!phrases.empty() && !positions_)
+        {
+            throw std::invalid_argument("Phrase queries require the positional index");
+        }
+        for (const auto &phrase : phrases)
+        {
+            PhrasePlan phrase_plan{ResolveTerms(phrase.words, false), phrase.slop};
+            if (phrase_plan.terms.size() != phrase.words.size())
+            {
+                plan.has_missing_required_term = true;
+            }
+            plan.phrases.push_back(std::move(phrase_plan));
+        }
+        return plan;
+    }
+
+    QueryPlan BuildQueryPlan(const Query &query, std::vector<std::string_view> *term_words = nullptr) const
+    {
+        return BuildQueryPlan(query.plus_words, query.minus_words, query.required_words, query.phrases, term_words);
+    }
+
+    bool MatchesPhraseAt(const PhrasePlan &phrase, uint32_t ordinal) const;
+
+    // True if the document contains every phrase of the query (always true without phrases)
+    bool MatchesPhrases(const Query &query, const QueryPlan &plan, uint32_t ordinal) const;
+
+    // Sorted ordinals of documents containing every required term and every phrase. Required and
+    // phrase terms are intersected first; positions are decoded only for the documents that survive.
+    // hooks.control is checked between candidate blocks; a stopped query keeps the candidates found so far
+    std::vector<uint32_t> MatchCandidates(const QueryPlan &plan, const ScoringHooks &hooks) const;
+
+    // Re-resolves the plan unless it was built by this very server at its current generation
+    void RefreshPreparedQuery(PreparedQuery &query) const;
+
+    static uint64_t NextGeneration();
+
+    CorpusStats GetCorpusStats() const;
+
+    template <typename Ranking>
+    std::vector<double> ComputeTermWeights(const std::vector<TermPlan> &terms, const CorpusStats &stats,
+                                           const Ranking &ranking) const
+    {
+        std::vector<double> weights;
+        weights.reserve(terms.size());
+        for (const TermPlan &term : terms)
+        {
+            weights.push_back(ranking.TermWeight(stats, term.postings->size()));
+        }
+        return weights;
+    }
+
+    // Relevance (within 1e-6), then rating, then id, so ties do not depend on the internal ordinals
+    static bool CompareByRelevance(const Document &lhs, const Document &rhs);
+
+    // How many ordinals a query tests against its filter: the shortest required or phrase term list
+    // for the candidate path, every plus-term posting otherwise
+    static size_t EstimateFilterChecks(const QueryPlan &plan);
+
+    static bool AcceptAll(int, DocumentStatus, int)
+    {
+        return true;
+    }
+
+    static DocumentFilter MakeStatusFilter(DocumentStatus status)
+    {
+        DocumentFilter filter;
+        filter.status = status;
+        return filter;
+    }
+
+    template <typename ExecutionPolicy, typename Key_mapper, typename Ranking>
+    std::vector<Document> FindTopDocumentsByPlan(ExecutionPolicy &&exec_policy, const QueryPlan &plan,
+                                                 const DocumentMask *mask, Key_mapper key,
+                                                 const Ranking &ranking, const ScoringHooks &hooks = {}) const
+    {
+        std::vector<Document> matched_documents =
+            FindAllDocuments(exec_policy, plan, mask, key, ranking, hooks);
+
+        TRACE_SCOPE(TraceStage::TOP_K);
+        const size_t result_count = std::min<size_t>(matched_documents.size(), MAX_RESULT_DOCUMENT_COUNT);
+        std::partial_sort(exec_policy, matched_documents.begin(), matched_documents.begin() + result_count,
+                          matched_documents.end(), CompareByRelevance);
+        matched_documents.resize(result_count);
+        return matched_documents;
+    }
+
+    // Postings are walked in blocks of this size; deadlines and cancellation are checked between blocks
+    static const size_t POSTING_BLOCK_SIZE = 1024;
+
+    // Number of MinHash values that order documents in ReorderDocuments
+    static constexpr size_t MINHASH_SIZE = 4;
+
+    // The cursor is cut and only page_size + 1 documents are kept while the results are collected,
+    // so the matched documents after the cursor are never materialized.
+    // Scoring is sequential: the relevance of the cursor document must come out bit for bit the same
+    // as on the previous page, and parallel accumulation sums the term scores in a varying order
+    template <typename Key_mapper, typename Ranking>
+    SearchPage FindPageByPlan(const QueryPlan &plan, const DocumentMask *mask, Key_mapper key,
+                              const std::string_view cursor_token, size_t page_size, const Ranking &ranking) const
+    {
+        ScoringHooks hooks;
+        Document after;
+        if (!cursor_token.empty())
+        {
+            const SearchCursor cursor = DecodeCursor(cursor_token);
+            after = Document(cursor.id, cursor.relevance, cursor.rating);
+            hooks.after = &after;
+        }
+        // One document past the page tells whether there is a next one
+        hooks.limit = page_size + 1;
+        return SelectPage(FindAllDocuments(std::execution::seq, plan, mask, key, ranking, hooks), page_size);
+    }
+
+    // Adds a document that passed the cursor and the predicate to the results of a scoring pass
+    static void CollectDocument(std::vector<Document> &documents, const Document &document, uint32_t ordinal,
+                                const ScoringHooks &hooks)
+    {
+        if (hooks.limit == 0)
+        {
+            documents.push_back(document);
+            if (hooks.ordinals != nullptr)
+            {
+                hooks.ordinals->push_back(ordinal);
+            }
+            return;
+        }
+        // Max-heap in ComesBefore order: the front is the document that would be dropped first
+        if (documents.size() < hooks.limit)
+        {
+            documents.push_back(document);
+            std::push_heap(documents.begin(), documents.end(), ComesBefore);
+        }
+        else if (ComesBefore(document, documents.front()))
+        {
+            std::pop_heap(documents.begin(), documents.end(), ComesBefore);
+            documents.back() = document;
+            std::push_heap(documents.begin(), documents.end(), ComesBefore);
+        }
+    }
+
+    // mask may be null; documents it does not accept are skipped before scoring,
+    // key is the arbitrary predicate applied to the survivors
+    template <typename ExecutionPolicy, typename Key_mapper, typename Ranking>
+    std::vector<Document> FindAllDocuments(ExecutionPolicy &&exec_policy, const QueryPlan &plan,
+                                           const DocumentMask *mask, Key_mapper key,
+                                           const Ranking &ranking, const ScoringHooks &hooks = {}) const
+    {
+        if (!plan.phrases.empty() || !plan.required_terms.empty() || plan.has_missing_required_term)
+        {
+            return FindCandidateDocuments(plan, mask, key, ranking, hooks);
+        }
+
+        const CorpusStats stats = GetCorpusStats();
+        const std::vector<double> weights = ComputeTermWeights(plan.plus_terms, stats, ranking);
 
-                    const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-                    for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word))
+        ConcurrentMap<uint32_t, double> ordinal_to_relevance(16);
+
+        {
+            TRACE_SCOPE(TraceStage::POSTINGS);
+            std::for_each(exec_policy, plan.plus_terms.begin(), plan.plus_terms.end(), [&](const TermPlan &term) {
+                const size_t term_index = &term - plan.plus_terms.data();
+                const double weight = weights[term_index];
+                const PostingList &postings = *term.postings;
+                ScopedTermStats term_stats(hooks, term_index);
+                for (size_t block = 0; block < postings.size(); block += POSTING_BLOCK_SIZE)
+                {
+                    if (block > 0 && hooks.control != nullptr && hooks.control->ShouldStop())
+                    {
+                        return;
+                    }
+                    const size_t block_end = std::min(postings.size(), block + POSTING_BLOCK_SIZE);
+                    for (size_t i = block; i < block_end; ++i)
                     {
-                        document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
+                        const auto [ordinal, term_freq] = postings[i];
+                        if (mask != nullptr && !mask->Accepts(ordinal))
+                        {
+                            term_stats.RejectPosting();
+                            continue;
+                        }
+                        ordinal_to_relevance[ordinal].ref_to_value +=
+                            ranking.Score(stats, weight, term_freq, attributes_.GetLength(ordinal));
                     }
+                    term_stats.ScanPostings(block_end - block);
                 }
             });
+        }
 
-        std::for_each(exec_policy, query.minus_words.begin(), query.minus_words.end(),
-                      [&](const std::string_view word) {
-                          if (word_to_document_freqs_.count(word) != 0)
-                          {
-                              for (const auto [document_id, _] : word_to_document_freqs_.at(word))
+        {
+            TRACE_SCOPE(TraceStage::MINUS_FILTER);
+            std::for_each(exec_policy, plan.minus_terms.begin(), plan.minus_terms.end(),
+                          [&](const TermPlan &term) {
+                              ScopedTermStats term_stats(hooks,
+                                                         plan.plus_terms.size() + (&term - plan.minus_terms.data()));
+                              for (const auto [ordinal, _] : *term.postings)
                               {
-                                  document_to_relevance.erase(document_id);
+                                  term_stats.ExcludeDocuments(ordinal_to_relevance.erase(ordinal));
                               }
-                          }
-                      });
+                              term_stats.ScanPostings(term.postings->size());
+                          });
+        }
 
+        TRACE_SCOPE(TraceStage::PREDICATE);
         std::vector<Document> matched_documents;
 
-        for (const auto [document_id, relevance] : document_to_relevance.BuildOrdinaryMap())
+        for (const auto [ordinal, relevance] : ordinal_to_relevance.BuildOrdinaryMap())
+        {
+            const int document_id = attributes_.GetId(ordinal);
+            const DocumentData data = attributes_.Get(ordinal);
+            const Document document(document_id, relevance, data.rating);
+            if ((hooks.after == nullptr || ComesBefore(*hooks.after, document)) &&
+                key(document_id, data.status, data.rating))
+            {
+                CollectDocument(matched_documents, document, ordinal, hooks);
+            }
+        }
+        return matched_documents;
+    }
+
+    // Queries per chunk of FindTopDocumentsBatch
+    static constexpr size_t BATCH_CHUNK_SIZE = 256;
+
+    // Ordinals scored at a time by FindTopDocumentsShared. Its working memory is a few words per
+    // ordinal of this window for every distinct term of the chunk, whatever the posting volume
+    static constexpr size_t BATCH_ORDINAL_WINDOW = 4096;
+
+    // Scores plain queries (no required terms or phrases) sharing one walk per posting list. A term
+    // weight depends only on its posting list, so a posting is scored once for all its queries.
+    // The ordinal space is walked in windows: every list's postings in the window are scored into a
+    // buffer, then each query sums them in a dense accumulator in its own term order, so relevances
+    // match FindAllDocuments. Each query keeps only a bounded top between windows
+    template <typename Ranking>
+    void FindTopDocumentsShared(const std::vector<QueryPlan> &plans, const size_t *query_indexes, size_t query_count,
+                                const DocumentMask &mask, const Ranking &ranking,
+                                std::vector<std::vector<Document>> &results) const
+    {
+        struct ScoredPosting
+        {
+            uint32_t ordinal;
+            double score;
+        };
+        struct SharedList
+        {
+            const PostingList *postings;
+            double weight;
+            size_t position = 0;
+            // Accepted postings of the current window with their scores
+            std::vector<ScoredPosting> window;
+        };
+
+        const CorpusStats stats = GetCorpusStats();
+        std::vector<SharedList> lists;
+        std::vector<std::vector<size_t>> query_lists(query_count);
+        {
+            std::map<const PostingList *, size_t> list_indexes;
+            for (size_t query = 0; query < query_count; ++query)
+            {
+                for (const TermPlan &term : plans[query_indexes[query]].plus_terms)
+                {
+                    const auto [it, is_new] = list_indexes.emplace(term.postings, lists.size());
+                    if (is_new)
+                    {
+                        lists.push_back({term.postings, ranking.TermWeight(stats, term.postings->size()), 0, {}});
+                    }
+                    query_lists[query].push_back(it->second);
+                }
+            }
+        }
+
+        std::vector<std::vector<Document>> tops(query_count);
+        std::vector<std::vector<size_t>> minus_cursors(query_count);
+        for (size_t query = 0; query < query_count; ++query)
+        {
+            minus_cursors[query].assign(plans[query_indexes[query]].minus_terms.size(), 0);
+        }
+        std::vector<double> relevances(BATCH_ORDINAL_WINDOW, 0.0);
+        std::vector<char> is_touched(BATCH_ORDINAL_WINDOW, 0);
+        std::vector<uint32_t> touched;
+
+        for (size_t window_start = 0; window_start < attributes_.size(); window_start += BATCH_ORDINAL_WINDOW)
+        {
+            const uint32_t window_end =
+                static_cast<uint32_t>(std::min(attributes_.size(), window_start + BATCH_ORDINAL_WINDOW));
+            {
+                TRACE_SCOPE(TraceStage::POSTINGS);
+                for (SharedList &list : lists)
+                {
+                    const PostingList &postings = *list.postings;
+                    const size_t position_end = GallopTo(postings, list.position, window_end);
+                    list.window.clear();
+                    for (; list.position < position_end; ++list.position)
+                    {
+                        const auto [ordinal, term_freq] = postings[list.position];
+                        if (mask.Accepts(ordinal))
+                        {
+                            list.window.push_back(
+                                {ordinal, ranking.Score(stats, list.weight, term_freq, attributes_.GetLength(ordinal))});
+                        }
+                    }
+                }
+            }
+
+            for (size_t query = 0; query < query_count; ++query)
+            {
+                for (const size_t list_index : query_lists[query])
+                {
+                    for (const auto [ordinal, score] : lists[list_index].window)
+                    {
+                        const size_t slot = ordinal - window_start;
+                        if (!is_touched[slot])
+                        {
+                            is_touched[slot] = 1;
+                            touched.push_back(ordinal);
+                        }
+                        relevances[slot] += score;
+                    }
+                }
+                std::sort(touched.begin(), touched.end());
+
+                const QueryPlan &plan = plans[query_indexes[query]];
+                std::vector<Document> &top = tops[query];
+                for (const uint32_t ordinal : touched)
+                {
+                    const size_t slot = ordinal - window_start;
+                    bool is_excluded = false;
+                    for (size_t j = 0; j < plan.minus_terms.size() && !is_excluded; ++j)
+                    {
+                        const PostingList &postings = *plan.minus_terms[j].postings;
+                        size_t &cursor = minus_cursors[query][j];
+                        cursor = GallopTo(postings, cursor, ordinal);
+                        is_excluded = cursor < postings.size() && postings[cursor].ordinal == ordinal;
+                    }
+                    if (!is_excluded)
+                    {
+                        top.push_back({attributes_.GetId(ordinal), relevances[slot], attributes_.GetRating(ordinal)});
+                    }
+                    relevances[slot] = 0.0;
+                    is_touched[slot] = 0;
+                }
+                touched.clear();
+
+                if (top.size() >= BATCH_ORDINAL_WINDOW)
+                {
+                    TRACE_SCOPE(TraceStage::TOP_K);
+                    std::partial_sort(top.begin(), top.begin() + MAX_RESULT_DOCUMENT_COUNT, top.end(),
+                                      CompareByRelevance);
+                    top.resize(MAX_RESULT_DOCUMENT_COUNT);
+                }
+            }
+        }
+
+        TRACE_SCOPE(TraceStage::TOP_K);
+        for (size_t query = 0; query < query_count; ++query)
+        {
+            std::vector<Document> &top = tops[query];
+            const size_t result_count = std::min<size_t>(top.size(), MAX_RESULT_DOCUMENT_COUNT);
+            std::partial_sort(top.begin(), top.begin() + result_count, top.end(), CompareByRelevance);
+            top.resize(result_count);
+            results[query_indexes[query]] = std::move(top);
+        }
+    }
+
+    // Required terms and phrases restrict the result to a small sorted candidate set, so the other
+    // terms are not walked in full: each keeps a cursor that gallops forward to the next candidate
+    template <typename Key_mapper, typename Ranking>
+    std::vector<Document> FindCandidateDocuments(const QueryPlan &plan, const DocumentMask *mask,
+                                                 Key_mapper key, const Ranking &ranking,
+                                                 const ScoringHooks &hooks) const
+    {
+        std::vector<Document> matched_documents;
+        if (plan.has_missing_required_term)
+        {
+            return matched_documents;
+        }
+        const CorpusStats stats = GetCorpusStats();
+        const std::vector<double> weights = ComputeTermWeights(plan.plus_terms, stats, ranking);
+        std::vector<uint32_t> candidates;
+        {
+            TRACE_SCOPE(TraceStage::POSTINGS);
+            candidates = MatchCandidates(plan, hooks);
+        }
+        TRACE_SCOPE(TraceStage::PREDICATE);
+        std::vector<size_t> plus_cursors(plan.plus_terms.size(), 0);
+        std::vector<size_t> minus_cursors(plan.minus_terms.size(), 0);
+        for (size_t index = 0; index < candidates.size(); ++index)
         {
-            if (key(document_id, documents_.at(document_id).status, documents_.at(document_id).rating))
+            if (hooks.control != nullptr && index > 0 && index % POSTING_BLOCK_SIZE == 0 &&
+                hooks.control->ShouldStop())
+            {
+                break;
+            }
+            const uint32_t ordinal = candidates[index];
+            if (mask != nullptr && !mask->Accepts(ordinal))
+            {
+                if (hooks.explanation != nullptr)
+                {
+                    ++hooks.explanation->candidate_rejections;
+                }
+                continue;
+            }
+            bool is_excluded = false;
+            for (size_t i = 0; i < plan.minus_terms.size() && !is_excluded; ++i)
+            {
+                const PostingList &postings = *plan.minus_terms[i].postings;
+                minus_cursors[i] = GallopTo(postings, minus_cursors[i], ordinal);
+                is_excluded = minus_cursors[i] < postings.size() && postings[minus_cursors[i]].ordinal == ordinal;
+                if (hooks.explanation != nullptr)
+                {
+                    TermExplanation &term = hooks.explanation->terms[plan.plus_terms.size() + i];
+                    ++term.postings_scanned;
+                    term.documents_excluded += is_excluded;
+                }
+            }
+            if (is_excluded)
+            {
+                continue;
+            }
+            double relevance = 0.0;
+            for (size_t i = 0; i < plan.plus_terms.size(); ++i)
+            {
+                const PostingList &postings = *plan.plus_terms[i].postings;
+                plus_cursors[i] = GallopTo(postings, plus_cursors[i], ordinal);
+                if (hooks.explanation != nullptr)
+                {
+                    ++hooks.explanation->terms[i].postings_scanned;
+                }
+                if (plus_cursors[i] < postings.size() && postings[plus_cursors[i]].ordinal == ordinal)
+                {
+                    relevance += ranking.Score(stats, weights[i], postings[plus_cursors[i]].term_freq,
+                                               attributes_.GetLength(ordinal));
+                }
+            }
+            const int document_id = attributes_.GetId(ordinal);
+            const DocumentData data = attributes_.Get(ordinal);
+            const Document document(document_id, relevance, data.rating);
+            if ((hooks.after == nullptr || ComesBefore(*hooks.after, document)) &&
+                key(document_id, data.status, data.rating))
             {
-                matched_documents.push_back({document_id, relevance, documents_.at(document_id).rating});
+                CollectDocument(matched_documents, document, ordinal, hooks);
             }
         }
         return matched_documents;
     }
 
     template <typename Key_mapper>
-    std::vector<Document> FindAllDocuments(const Query &query, Key_mapper key) const
+    std::vector<Document> FindAllDocuments(const QueryPlan &plan, Key_mapper key) const
     {
-        return FindAllDocuments(std::execution::seq, query, key);
+        return FindAllDocuments(std::execution::seq, plan, nullptr, key, TfIdfRanking{});
     }
 };
@@ -44,3 +44,42 @@ vector<string> SplitIntoWords(string_view text)
 
     return words;
 }
+
+u32string DecodeUtf8(string_view text)
+{
+    u32string result;
+    result.reserve(text.size());
+    for (size_t i = 0; i < text.size();)
+    {
+        const unsigned char lead = static_cast<unsigned char>(text[i]);
+        size_t length = 1;
+        char32_t code = lead;
+        if (lead >= 0xF0)
+        {
+            length = 4;
+            code = lead & 0x07;
+        }
+        else if (lead >= 0xE0)
+        {
+            length = 3;
+            code = lead & 0x0F;
+        }
+        else if (lead >= 0xC0)
+        {
+            length = 2;
+            code = lead & 0x1F;
+        }
+        if (i + length > text.size())
+        {
+            length = 1;
+            code = lead;
+        }
+        for (size_t j = 1; j < length; ++j)
+        {
+            code = (code << 6) | (static_cast<unsigned char>(text[i + j]) & 0x3F);
+        }
+        result.push_back(code);
+        i += length;
+    }
+    return result;
+}
@@ -19,4 +19,7 @@ std::set<std::string> MakeUniqueNonEmptyStrings(const StringContainer &strings)
 
 std::vector<std::string> SplitIntoWords(const std::string_view text);
 
-std::vector<std::string_view> SplitIntoWordsView(std::string_view text);
\ No newline at end of file
+std::vector<std::string_view> SplitIntoWordsView(std::string_view text);
+
+// Invalid bytes are passed through as single code points
+std::u32string DecodeUtf8(std::string_view text);
@@ -0,0 +1,137 @@
+#include "term_trie.h"
+#include "memory_usage.h"
+#include "string_processing.h"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+const uint32_t NO_NODE = static_cast<uint32_t>(-1);
+
+bool LessLetter(const pair<char32_t, uint32_t> &child, char32_t letter)
+{
+    return child.first < letter;
+}
+} // namespace
+
+TermTrie::TermTrie() : nodes_(1)
+{
+}
+
+size_t TermTrie::GetMemoryUsage() const
+{
+    size_t bytes = GetVectorBytes(nodes_);
+    for (const Node &node : nodes_)
+    {
+        bytes += GetVectorBytes(node.children);
+    }
+    return bytes;
+}
+
+void TermTrie::Insert(string_view word, size_t term_id)
+{
+    uint32_t node = 0;
+    for (const char32_t letter : DecodeUtf8(word))
+    {
+        auto &children = nodes_[node].children;
+        auto it = lower_bound(children.begin(), children.end(), letter, LessLetter);
+        if (it != children.end() && it->first == letter)
+        {
+            node = it->second;
+            continue;
+        }
+        const uint32_t child = static_cast<uint32_t>(nodes_.size());
+        children.insert(it, {letter, child});
+        nodes_.emplace_back(); // may reallocate nodes_, so children must not be used after this
+        node = child;
+    }
+    nodes_[node].term_id = term_id;
+}
+
+uint32_t TermTrie::FindChild(uint32_t node, char32_t letter) const
+{
+    const auto &children = nodes_[node].children;
+    auto it = lower_bound(children.begin(), children.end(), letter, LessLetter);
+    return it != children.end() && it->first == letter ? it->second : NO_NODE;
+}
+
+vector<size_t> TermTrie::FindByPrefix(string_view prefix) const
+{
+    vector<size_t> term_ids;
+    uint32_t node = 0;
+    for (const char32_t letter : DecodeUtf8(prefix))
+    {
+        node = FindChild(node, letter);
+        if (node == NO_NODE)
+        {
+            return term_ids;
+        }
+    }
+    CollectTerms(node, term_ids);
+    return term_ids;
+}
+
+void TermTrie::CollectTerms(uint32_t node, vector<size_t> &term_ids) const
+{
+    if (nodes_[node].term_id != NO_TERM)
+    {
+        term_ids.push_back(nodes_[node].term_id);
+    }
+    for (const auto &[letter, child] : nodes_[node].children)
+    {
+        CollectTerms(child, term_ids);
+    }
+}
+
+vector<size_t> TermTrie::FindWithinDistance(string_view word, int max_distance) const
+{
+    const u32string letters = DecodeUtf8(word);
+    vector<int> first_row(letters.size() + 1);
+    for (size_t i = 0; i < first_row.size(); ++i)
+    {
+        first_row[i] = static_cast<int>(i);
+    }
+
+    vector<size_t> term_ids;
+    if (static_cast<int>(letters.size()) <= max_distance && nodes_[0].term_id != NO_TERM)
+    {
+        term_ids.push_back(nodes_[0].term_id);
+    }
+    for (const auto &[letter, child] : nodes_[0].children)
+    {
+        CollectWithinDistance(child, letter, letters, first_row, max_distance, term_ids);
+    }
+    return term_ids;
+}
+
+// One row of the Levenshtein table per trie level; a branch is cut as soon as
+// every cell of its row exceeds max_distance
+void TermTrie::CollectWithinDistance(uint32_t node, char32_t letter, const u32string &word,
+                                     const vector<int> &previous_row, int max_distance,
+                                     vector<size_t> &term_ids) const
+{
+    vector<int> row(previous_row.size());
+    row[0] = previous_row[0] + 1;
+    for (size_t i = 1; i < row.size(); ++i)
+    {
+        const int replace_cost = previous_row[i - 1] + (word[i - 1] == letter ? 0 : 1);
+        row[i] = min({row[i - 1] + 1, previous_row[i] + 1, replace_cost});
+    }
+
+    if (row.back() <= max_distance && nodes_[node].term_id != NO_TERM)
+    {
+        term_ids.push_back(nodes_[node].term_id);
+    }
+    if (*min_element(row.begin(), row.end()) <= max_distance)
+    {
+        for (const auto &[next_letter, child] : nodes_[node].children)
+        {
+            CollectWithinDistance(child, next_letter, word, row, max_distance, term_ids);
+        }
+    }
+}
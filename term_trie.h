@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Trie over the vocabulary, keyed by Unicode code points so that an edit of one Cyrillic letter
+// counts as one edit. Lookups only visit the part of the trie that can still match,
+// instead of scanning every word.
+class TermTrie
+{
+public:
+    TermTrie();
+
+    void Insert(std::string_view word, size_t term_id);
+
+    // Term ids of all words starting with prefix
+    std::vector<size_t> FindByPrefix(std::string_view prefix) const;
+
+    // Term ids of all words within max_distance Levenshtein edits of word
+    std::vector<size_t> FindWithinDistance(std::string_view word, int max_distance) const;
+
+    size_t GetNodeCount() const
+    {
+        return nodes_.size();
+    }
+
+    // Approximate heap bytes of the nodes
+    size_t GetMemoryUsage() const;
+
+private:
+    static const size_t NO_TERM = static_cast<size_t>(-1);
+
+    struct Node
+    {
+        // Sorted by code point
+        std::vector<std::pair<char32_t, uint32_t>> children;
+        size_t term_id = NO_TERM;
+    };
+
+    std::vector<Node> nodes_;
+
+    uint32_t FindChild(uint32_t node, char32_t letter) const;
+
+    void CollectTerms(uint32_t node, std::vector<size_t> &term_ids) const;
+
+    void CollectWithinDistance(uint32_t node, char32_t letter, const std::u32string &word,
+                               const std::vector<int> &previous_row, int max_distance,
+                               std::vector<size_t> &term_ids) const;
+};
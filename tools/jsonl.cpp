@@ -0,0 +1,223 @@
+#include "jsonl.h"
+
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+class JsonLineParser
+{
+public:
+    explicit JsonLineParser(string_view text) : text_(text)
+    {
+    }
+
+    map<string, JsonValue> ParseObject()
+    {
+        map<string, JsonValue> result;
+        Expect('{');
+        SkipSpaces();
+        if (Peek() == '}')
+        {
+            ++pos_;
+            return result;
+        }
+        while (true)
+        {
+            SkipSpaces();
+            string key = ParseString();
+            SkipSpaces();
+            Expect(':');
+            result[move(key)] = ParseValue();
+            SkipSpaces();
+            if (Peek() == ',')
+            {
+                ++pos_;
+                continue;
+            }
+            Expect('}');
+            break;
+        }
+        SkipSpaces();
+        if (pos_ != text_.size())
+        {
+            Fail();
+        }
+        return result;
+    }
+
+private:
+    string_view text_;
+    size_t pos_ = 0;
+
+    [[noreturn]] void Fail() const
+    {
+        throw invalid_argument("Malformed JSON line at position "s + to_string(pos_));
+    }
+
+    char Peek() const
+    {
+        return pos_ < text_.size() ? text_[pos_] : '\0';
+    }
+
+    void SkipSpaces()
+    {
+        while (pos_ < text_.size() && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\r'))
+        {
+            ++pos_;
+        }
+    }
+
+    void Expect(char c)
+    {
+        SkipSpaces();
+        if (Peek() != c)
+        {
+            Fail();
+        }
+        ++pos_;
+    }
+
+    JsonValue ParseValue()
+    {
+        SkipSpaces();
+        JsonValue value;
+        const char c = Peek();
+        if (c == '"')
+        {
+            value.type = JsonValue::Type::STRING;
+            value.str = ParseString();
+        }
+        else if (c == '[')
+        {
+            value.type = JsonValue::Type::NUMBER_ARRAY;
+            ++pos_;
+            SkipSpaces();
+            if (Peek() == ']')
+            {
+                ++pos_;
+                return value;
+            }
+            while (true)
+            {
+                SkipSpaces();
+                value.numbers.push_back(ParseNumber());
+                SkipSpaces();
+                if (Peek() == ',')
+                {
+                    ++pos_;
+                    continue;
+                }
+                Expect(']');
+                break;
+            }
+        }
+        else if (text_.substr(pos_, 4) == "true" || text_.substr(pos_, 5) == "false")
+        {
+            value.type = JsonValue::Type::BOOLEAN;
+            value.boolean = c == 't';
+            pos_ += value.boolean ? 4 : 5;
+        }
+        else if (text_.substr(pos_, 4) == "null")
+        {
+            pos_ += 4;
+        }
+        else
+        {
+            value.type = JsonValue::Type::NUMBER;
+            value.number = ParseNumber();
+        }
+        return value;
+    }
+
+    double ParseNumber()
+    {
+        const string rest(text_.substr(pos_, 64));
+        char *end = nullptr;
+        const double number = strtod(rest.c_str(), &end);
+        if (end == rest.c_str())
+        {
+            Fail();
+        }
+        pos_ += static_cast<size_t>(end - rest.c_str());
+        return number;
+    }
+
+    void AppendUtf8(string &out, unsigned code)
+    {
+        if (code < 0x80)
+        {
+            out += static_cast<char>(code);
+        }
+        else if (code < 0x800)
+        {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        else
+        {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+    string ParseString()
+    {
+        Expect('"');
+        string result;
+        while (pos_ < text_.size() && text_[pos_] != '"')
+        {
+            char c = text_[pos_++];
+            if (c != '\\')
+            {
+                result += c;
+                continue;
+            }
+            if (pos_ >= text_.size())
+            {
+                Fail();
+            }
+            c = text_[pos_++];
+            switch (c)
+            {
+            case 'n':
+                result += '\n';
+                break;
+            case 't':
+                result += '\t';
+                break;
+            case 'r':
+                result += '\r';
+                break;
+            case 'u':
+            {
+                if (pos_ + 4 > text_.size())
+                {
+                    Fail();
+                }
+                const string hex(text_.substr(pos_, 4));
+                AppendUtf8(result, static_cast<unsigned>(strtoul(hex.c_str(), nullptr, 16)));
+                pos_ += 4;
+                break;
+            }
+            default:
+                result += c;
+            }
+        }
+        Expect('"');
+        return result;
+    }
+};
+} // namespace
+
+map<string, JsonValue> ParseJsonLine(string_view line)
+{
+    return JsonLineParser(line).ParseObject();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Value of a flat JSON object: string, number, array of numbers, boolean or null
+struct JsonValue
+{
+    enum class Type
+    {
+        NULL_VALUE,
+        BOOLEAN,
+        NUMBER,
+        STRING,
+        NUMBER_ARRAY,
+    };
+
+    Type type = Type::NULL_VALUE;
+    bool boolean = false;
+    double number = 0;
+    std::string str;
+    std::vector<double> numbers;
+};
+
+// Parses one JSONL line holding a flat object; nested objects are not supported.
+// Throws std::invalid_argument on malformed input
+std::map<std::string, JsonValue> ParseJsonLine(std::string_view line);
@@ -0,0 +1,291 @@
+// Offline load generator: loads a corpus into SearchServer and replays a query log against it.
+//
+// Usage:
+//   load_replay --corpus docs.jsonl --queries queries.jsonl [--threads N] [--mode closed|open]
+//               [--qps R] [--repeat K] [--stop-words "и в на"]
+//
+// Corpus lines:  {"id": 1, "status": "ACTUAL", "ratings": [1, 2, 3], "text": "пушистый кот"}
+// Query lines:   {"query": "пушистый -кот", "status": "ACTUAL", "expected_ids": [1, 4]}
+// status is optional (ACTUAL by default), expected_ids is optional.
+//
+// closed mode: every thread sends its next query as soon as the previous one returns.
+// open mode: queries are due at a fixed --qps rate; latency counts from the due time,
+// so a stalled server shows up as queueing delay instead of a lower request rate.
+
+#include "../latency_histogram.h"
+#include "../search_server.h"
+#include "jsonl.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+struct ReplayOptions
+{
+    string corpus_path;
+    string queries_path;
+    string stop_words;
+    size_t threads = 1;
+    bool is_open_loop = false;
+    double qps = 1000;
+    size_t repeat = 1;
+};
+
+struct LoggedQuery
+{
+    string text;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    bool has_expected = false;
+    vector<int> expected_ids;
+};
+
+DocumentStatus ParseStatus(const string &name)
+{
+    if (name == "ACTUAL")
+        return DocumentStatus::ACTUAL;
+    if (name == "IRRELEVANT")
+        return DocumentStatus::IRRELEVANT;
+    if (name == "BANNED")
+        return DocumentStatus::BANNED;
+    if (name == "REMOVED")
+        return DocumentStatus::REMOVED;
+    throw invalid_argument("Unknown document status "s + name);
+}
+
+DocumentStatus GetStatus(const map<string, JsonValue> &object)
+{
+    auto it = object.find("status");
+    return it == object.end() ? DocumentStatus::ACTUAL : ParseStatus(it->second.str);
+}
+
+ReplayOptions ParseOptions(int argc, char *argv[])
+{
+    ReplayOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        const string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            throw invalid_argument("Missing value for "s + arg);
+        }
+        const string value = argv[++i];
+        if (arg == "--corpus")
+            options.corpus_path = value;
+        else if (arg == "--queries")
+            options.queries_path = value;
+        else if (arg == "--stop-words")
+            options.stop_words = value;
+        else if (arg == "--threads")
+            options.threads = max<size_t>(1, stoul(value));
+        else if (arg == "--mode")
+            options.is_open_loop = value == "open";
+        else if (arg == "--qps")
+            options.qps = stod(value);
+        else if (arg == "--repeat")
+            options.repeat = max<size_t>(1, stoul(value));
+        else
+            throw invalid_argument("Unknown option "s + arg);
+    }
+    if (options.corpus_path.empty() || options.queries_path.empty())
+    {
+        throw invalid_argument("Both --corpus and --queries are required"s);
+    }
+    return options;
+}
+
+size_t LoadCorpus(SearchServer &search_server, const string &path)
+{
+    ifstream in(path);
+    if (!in)
+    {
+        throw runtime_error("Can't open corpus "s + path);
+    }
+    size_t count = 0;
+    string line;
+    while (getline(in, line))
+    {
+        if (line.empty())
+        {
+            continue;
+        }
+        const auto object = ParseJsonLine(line);
+        vector<int> ratings;
+        auto ratings_it = object.find("ratings");
+        if (ratings_it != object.end())
+        {
+            for (const double rating : ratings_it->second.numbers)
+            {
+                ratings.push_back(static_cast<int>(rating));
+            }
+        }
+        if (ratings.empty())
+        {
+            ratings.push_back(0);
+        }
+        search_server.AddDocument(static_cast<int>(object.at("id").number), object.at("text").str,
+                                  GetStatus(object), ratings);
+        ++count;
+    }
+    return count;
+}
+
+vector<LoggedQuery> LoadQueries(const string &path)
+{
+    ifstream in(path);
+    if (!in)
+    {
+        throw runtime_error("Can't open query log "s + path);
+    }
+    vector<LoggedQuery> queries;
+    string line;
+    while (getline(in, line))
+    {
+        if (line.empty())
+        {
+            continue;
+        }
+        const auto object = ParseJsonLine(line);
+        LoggedQuery query;
+        query.text = object.at("query").str;
+        query.status = GetStatus(object);
+        auto expected = object.find("expected_ids");
+        if (expected != object.end())
+        {
+            query.has_expected = true;
+            for (const double id : expected->second.numbers)
+            {
+                query.expected_ids.push_back(static_cast<int>(id));
+            }
+        }
+        queries.push_back(move(query));
+    }
+    return queries;
+}
+
+// FNV-1a over the result ids in rank order
+uint64_t ComputeChecksum(const vector<Document> &documents)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (const Document &document : documents)
+    {
+        hash ^= static_cast<uint64_t>(static_cast<uint32_t>(document.id));
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    using Clock = chrono::steady_clock;
+    try
+    {
+        const ReplayOptions options = ParseOptions(argc, argv);
+
+        SearchServer search_server(options.stop_words);
+        const auto load_start = Clock::now();
+        const size_t document_count = LoadCorpus(search_server, options.corpus_path);
+        const double load_seconds = chrono::duration<double>(Clock::now() - load_start).count();
+        const vector<LoggedQuery> queries = LoadQueries(options.queries_path);
+        const size_t total = queries.size() * options.repeat;
+
+        LatencyHistogram latencies;
+        vector<uint64_t> checksums(queries.size());
+        atomic<size_t> next_index{0};
+        atomic<size_t> errors{0};
+        atomic<size_t> mismatches{0};
+
+        const auto replay_start = Clock::now();
+        auto worker = [&] {
+            while (true)
+            {
+                const size_t index = next_index.fetch_add(1);
+                if (index >= total)
+                {
+                    return;
+                }
+                const LoggedQuery &query = queries[index % queries.size()];
+
+                Clock::time_point start = Clock::now();
+                if (options.is_open_loop)
+                {
+                    const auto due = replay_start + chrono::duration_cast<Clock::duration>(
+                                                        chrono::duration<double>(index / options.qps));
+                    this_thread::sleep_until(due);
+                    start = due;
+                }
+                try
+                {
+                    const vector<Document> result = search_server.FindTopDocuments(query.text, query.status);
+                    latencies.Record(
+                        static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count()));
+                    if (index < queries.size())
+                    {
+                        checksums[index] = ComputeChecksum(result);
+                    }
+                    if (query.has_expected)
+                    {
+                        vector<int> ids;
+                        for (const Document &document : result)
+                        {
+                            ids.push_back(document.id);
+                        }
+                        if (ids != query.expected_ids)
+                        {
+                            ++mismatches;
+                        }
+                    }
+                }
+                catch (const exception &)
+                {
+                    ++errors;
+                }
+            }
+        };
+
+        vector<thread> threads;
+        for (size_t i = 0; i < options.threads; ++i)
+        {
+            threads.emplace_back(worker);
+        }
+        for (thread &t : threads)
+        {
+            t.join();
+        }
+        const double replay_seconds = chrono::duration<double>(Clock::now() - replay_start).count();
+
+        // Combined in log order, so the value does not depend on thread scheduling
+        uint64_t checksum = 0;
+        for (const uint64_t query_checksum : checksums)
+        {
+            checksum = checksum * 31 + query_checksum;
+        }
+
+        cout << "documents: " << document_count << " loaded in " << load_seconds << " s" << endl;
+        cout << "queries: " << total << " (" << queries.size() << " distinct), threads: " << options.threads
+             << ", mode: " << (options.is_open_loop ? "open" : "closed") << endl;
+        cout << "throughput: " << total / replay_seconds << " qps" << endl;
+        cout << "latency us: p50 " << latencies.GetPercentile(50) / 1000.0 << ", p99 "
+             << latencies.GetPercentile(99) / 1000.0 << ", p999 " << latencies.GetPercentile(99.9) / 1000.0
+             << ", max " << latencies.GetMax() / 1000.0 << endl;
+        cout << "errors: " << errors << ", expected id mismatches: " << mismatches << endl;
+        cout << "checksum: " << hex << checksum << dec << endl;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
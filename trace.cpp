@@ -0,0 +1,199 @@
+#include "trace.h"
+#include "latency_histogram.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+struct TraceEvent
+{
+    TraceStage stage;
+    TraceClock::time_point start;
+    TraceClock::time_point end;
+};
+
+struct ThreadTrace
+{
+    size_t thread_index = 0;
+    array<LatencyHistogram, TRACE_STAGE_COUNT> histograms;
+    array<atomic<uint64_t>, TRACE_STAGE_COUNT> total_ns{};
+    // Only touched while capturing; uncontended except when the trace is written
+    mutex events_mutex;
+    vector<TraceEvent> events;
+};
+
+struct TraceRegistry
+{
+    mutex threads_mutex;
+    // Kept after the thread exits so its samples still count
+    vector<shared_ptr<ThreadTrace>> threads;
+    atomic<bool> is_capturing{false};
+    atomic<size_t> max_events_per_thread{0};
+    const TraceClock::time_point origin = TraceClock::now();
+};
+
+TraceRegistry &GetRegistry()
+{
+    static TraceRegistry registry;
+    return registry;
+}
+
+ThreadTrace &GetThreadTrace()
+{
+    thread_local shared_ptr<ThreadTrace> trace = [] {
+        auto created = make_shared<ThreadTrace>();
+        TraceRegistry &registry = GetRegistry();
+        lock_guard<mutex> g(registry.threads_mutex);
+        created->thread_index = registry.threads.size();
+        registry.threads.push_back(created);
+        return created;
+    }();
+    return *trace;
+}
+
+vector<shared_ptr<ThreadTrace>> GetThreads()
+{
+    TraceRegistry &registry = GetRegistry();
+    lock_guard<mutex> g(registry.threads_mutex);
+    return registry.threads;
+}
+
+// Trace Event Format timestamps are microseconds, fractions keep nanosecond precision
+double ToMicroseconds(TraceClock::duration duration)
+{
+    return chrono::duration_cast<chrono::nanoseconds>(duration).count() / 1000.0;
+}
+} // namespace
+
+string_view GetTraceStageName(TraceStage stage)
+{
+    switch (stage)
+    {
+    case TraceStage::PARSE:
+        return "parse";
+    case TraceStage::RESOLVE:
+        return "resolve";
+    case TraceStage::POSTINGS:
+        return "postings";
+    case TraceStage::MINUS_FILTER:
+        return "minus_filter";
+    case TraceStage::PREDICATE:
+        return "predicate";
+    case TraceStage::TOP_K:
+        return "top_k";
+    case TraceStage::INDEXING:
+        return "indexing";
+    }
+    return "unknown";
+}
+
+void RecordTraceSample(TraceStage stage, TraceClock::time_point start, TraceClock::time_point end)
+{
+    ThreadTrace &trace = GetThreadTrace();
+    const size_t index = static_cast<size_t>(stage);
+    const uint64_t nanoseconds = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+    trace.histograms[index].Record(nanoseconds);
+    trace.total_ns[index].fetch_add(nanoseconds, memory_order_relaxed);
+
+    TraceRegistry &registry = GetRegistry();
+    if (registry.is_capturing.load(memory_order_relaxed))
+    {
+        lock_guard<mutex> g(trace.events_mutex);
+        if (trace.events.size() < registry.max_events_per_thread.load(memory_order_relaxed))
+        {
+            trace.events.push_back({stage, start, end});
+        }
+    }
+}
+
+array<TraceStageStats, TRACE_STAGE_COUNT> GetTraceStats()
+{
+    array<LatencyHistogram, TRACE_STAGE_COUNT> merged;
+    array<TraceStageStats, TRACE_STAGE_COUNT> stats;
+    for (const auto &trace : GetThreads())
+    {
+        for (size_t i = 0; i < TRACE_STAGE_COUNT; ++i)
+        {
+            merged[i].Merge(trace->histograms[i]);
+            stats[i].total_ns += trace->total_ns[i].load(memory_order_relaxed);
+        }
+    }
+    for (size_t i = 0; i < TRACE_STAGE_COUNT; ++i)
+    {
+        stats[i].count = merged[i].GetCount();
+        stats[i].p50_ns = merged[i].GetPercentile(50);
+        stats[i].p99_ns = merged[i].GetPercentile(99);
+        stats[i].max_ns = merged[i].GetMax();
+    }
+    return stats;
+}
+
+void ResetTraceStats()
+{
+    for (const auto &trace : GetThreads())
+    {
+        for (size_t i = 0; i < TRACE_STAGE_COUNT; ++i)
+        {
+            trace->histograms[i].Reset();
+            trace->total_ns[i].store(0, memory_order_relaxed);
+        }
+        lock_guard<mutex> g(trace->events_mutex);
+        trace->events.clear();
+    }
+}
+
+void WriteTraceStatsJson(ostream &out)
+{
+    const auto stats = GetTraceStats();
+    out << "{";
+    for (size_t i = 0; i < TRACE_STAGE_COUNT; ++i)
+    {
+        const TraceStageStats &stage = stats[i];
+        out << (i == 0 ? "" : ", ") << "\"" << GetTraceStageName(static_cast<TraceStage>(i)) << "\": {"
+            << "\"count\": " << stage.count << ", \"total_ns\": " << stage.total_ns
+            << ", \"p50_ns\": " << stage.p50_ns << ", \"p99_ns\": " << stage.p99_ns
+            << ", \"max_ns\": " << stage.max_ns << "}";
+    }
+    out << "}";
+}
+
+void StartTraceCapture(size_t max_events_per_thread)
+{
+    TraceRegistry &registry = GetRegistry();
+    registry.max_events_per_thread.store(max_events_per_thread, memory_order_relaxed);
+    registry.is_capturing.store(true, memory_order_relaxed);
+}
+
+void StopTraceCapture()
+{
+    GetRegistry().is_capturing.store(false, memory_order_relaxed);
+}
+
+void WriteChromeTrace(ostream &out)
+{
+    const TraceClock::time_point origin = GetRegistry().origin;
+    out << "{\"traceEvents\": [";
+    bool is_first = true;
+    for (const auto &trace : GetThreads())
+    {
+        lock_guard<mutex> g(trace->events_mutex);
+        for (const TraceEvent &event : trace->events)
+        {
+            out << (is_first ? "" : ",\n") << "{\"name\": \"" << GetTraceStageName(event.stage)
+                << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << trace->thread_index
+                << ", \"ts\": " << ToMicroseconds(event.start - origin)
+                << ", \"dur\": " << ToMicroseconds(event.end - event.start) << "}";
+            is_first = false;
+        }
+    }
+    out << "]}";
+}
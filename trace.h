@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+
+// Scoped probes around query and indexing stages. Samples go to per-thread histograms
+// (no shared cache lines on the hot path) and are merged only when statistics are requested.
+// Build with SEARCH_SERVER_TRACING=0 to compile the probes out entirely.
+#ifndef SEARCH_SERVER_TRACING
+#define SEARCH_SERVER_TRACING 1
+#endif
+
+#define TRACE_CONCAT_INTERNAL(X, Y) X##Y
+#define TRACE_CONCAT(X, Y) TRACE_CONCAT_INTERNAL(X, Y)
+
+#if SEARCH_SERVER_TRACING
+#define TRACE_SCOPE(stage) ScopedTraceProbe TRACE_CONCAT(traceProbe, __LINE__)(stage)
+#else
+#define TRACE_SCOPE(stage)
+#endif
+
+enum class TraceStage
+{
+    PARSE,
+    RESOLVE,
+    POSTINGS,
+    MINUS_FILTER,
+    PREDICATE,
+    TOP_K,
+    INDEXING,
+};
+
+const size_t TRACE_STAGE_COUNT = 7;
+
+std::string_view GetTraceStageName(TraceStage stage);
+
+struct TraceStageStats
+{
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t p50_ns = 0;
+    uint64_t p99_ns = 0;
+    uint64_t max_ns = 0;
+};
+
+using TraceClock = std::chrono::steady_clock;
+
+void RecordTraceSample(TraceStage stage, TraceClock::time_point start, TraceClock::time_point end);
+
+// Statistics of every stage merged over all threads, indexed by TraceStage
+std::array<TraceStageStats, TRACE_STAGE_COUNT> GetTraceStats();
+
+void ResetTraceStats();
+
+// {"parse": {"count": ..., "total_ns": ..., "p50_ns": ..., "p99_ns": ..., "max_ns": ...}, ...}
+void WriteTraceStatsJson(std::ostream &out);
+
+// While capturing, every probe is also kept as an event (up to max_events_per_thread per thread)
+// for WriteChromeTrace, which writes the Trace Event Format read by chrome://tracing and Perfetto
+void StartTraceCapture(size_t max_events_per_thread);
+
+void StopTraceCapture();
+
+void WriteChromeTrace(std::ostream &out);
+
+class ScopedTraceProbe
+{
+public:
+    explicit ScopedTraceProbe(TraceStage stage) : stage_(stage)
+    {
+    }
+
+    ScopedTraceProbe(const ScopedTraceProbe &) = delete;
+    ScopedTraceProbe &operator=(const ScopedTraceProbe &) = delete;
+
+    ~ScopedTraceProbe()
+    {
+        RecordTraceSample(stage_, start_, TraceClock::now());
+    }
+
+private:
+    TraceStage stage_;
+    const TraceClock::time_point start_ = TraceClock::now();
+};